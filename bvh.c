@@ -1,31 +1,60 @@
-#include "bvh.h"
+#include "bvh_internal.h"
+#include "parallel.h"
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #define MAX_PRIMS_PER_LEAF 4
 
-static AABB aabb_union(AABB a, AABB b) {
-    return (AABB){vec3_min(a.min, b.min), vec3_max(a.max, b.max)};
-}
+typedef struct {
+    AABB bounds;
+    int count;
+} SAHBin;
 
-static AABB triangle_bounds(Triangle t) {
-    Vec3 min = vec3_min(t.v0, vec3_min(t.v1, t.v2));
-    Vec3 max = vec3_max(t.v0, vec3_max(t.v1, t.v2));
-    return (AABB){min, max};
-}
+typedef struct {
+    SAHBin bins[3][MAX_SAH_BINS];
+} BinningResult;
 
 typedef struct {
-    int index;
     AABB bounds;
-    Vec3 centroid;
-} PrimInfo;
+    AABB centroid_bounds;
+} BoundsResult;
+
+BVHBuildOptions bvh_default_options(void) {
+    return (BVHBuildOptions){
+        .method = BVH_BUILD_SAH,
+        .sah_bins = 16,
+        .traversal_cost = 1.0f,
+        .intersection_cost = 1.0f,
+        .max_leaf_prims = 8,
+        .width = 0,
+        .num_threads = 1,
+        .morton_bits = 30,
+        .max_duplication = 0.3f,
+        .spatial_split_alpha = 1e-5f,
+        .refit_rebuild_ratio = 1.5f,
+        .compress_nodes = false,
+        .treelet_passes = 0
+    };
+}
+
+const char* bvh_method_name(BVHBuildMethod method) {
+    switch (method) {
+        case BVH_BUILD_MIDPOINT: return "midpoint";
+        case BVH_BUILD_LBVH: return "Morton LBVH";
+        case BVH_BUILD_SBVH: return "spatial-split SBVH";
+        default: return "binned SAH";
+    }
+}
 
 static int partition(PrimInfo* prims, int start, int end, int axis, float mid) {
     int i = start;
     int j = end - 1;
     while (i <= j) {
-        float c = (axis == 0) ? prims[i].centroid.x : ((axis == 1) ? prims[i].centroid.y : prims[i].centroid.z);
+        float c = vec3_axis(prims[i].centroid, axis);
         if (c < mid) i++;
         else {
             PrimInfo temp = prims[i];
@@ -37,134 +66,562 @@ static int partition(PrimInfo* prims, int start, int end, int axis, float mid) {
     return i;
 }
 
-static BVHNode* build_recursive(PrimInfo* prims, int start, int end, int* total_nodes, Triangle* triangles, int* indices) {
-    (*total_nodes)++;
-    BVHNode* node = (BVHNode*)calloc(1, sizeof(BVHNode));
+static BVHBuildNode* build_midpoint(BuildContext* ctx, PrimInfo* prims, int start, int end) {
+    BVHBuildNode* node = alloc_node(ctx);
     
     AABB bounds = prims[start].bounds;
     for (int i = start + 1; i < end; i++) bounds = aabb_union(bounds, prims[i].bounds);
     node->bounds = bounds;
     
     int count = end - start;
-    if (count <= MAX_PRIMS_PER_LEAF) {
-        node->first_prim_offset = start;
-        node->prim_count = count;
-        for(int i=start; i<end; ++i) indices[i] = prims[i].index;
-        return node;
-    }
+    if (count <= MAX_PRIMS_PER_LEAF) return make_leaf(ctx, node, prims, start, end);
     
     Vec3 extent = vec3_sub(bounds.max, bounds.min);
     int axis = 0;
     if (extent.y > extent.x) axis = 1;
     if (extent.z > (axis == 0 ? extent.x : extent.y)) axis = 2;
     
-    float mid = (axis == 0) ? (bounds.min.x + bounds.max.x) * 0.5f : 
-                ((axis == 1) ? (bounds.min.y + bounds.max.y) * 0.5f : 
-                               (bounds.min.z + bounds.max.z) * 0.5f);
-                               
+    float mid = (vec3_axis(bounds.min, axis) + vec3_axis(bounds.max, axis)) * 0.5f;
     int split = partition(prims, start, end, axis, mid);
     
     if (split == start || split == end) {
-        node->first_prim_offset = start;
-        node->prim_count = count;
-        for(int i=start; i<end; ++i) indices[i] = prims[i].index;
-        return node;
+        if (count <= BVH_MAX_LEAF_PRIMS) return make_leaf(ctx, node, prims, start, end);
+        split = start + count / 2;
     }
     
     node->axis = axis;
-    node->left = build_recursive(prims, start, split, total_nodes, triangles, indices);
-    node->right = build_recursive(prims, split, end, total_nodes, triangles, indices);
+    node->children[0] = build_midpoint(ctx, prims, start, split);
+    node->children[1] = build_midpoint(ctx, prims, split, end);
+    return node;
+}
+
+static int partition_bins(PrimInfo* prims, int start, int end, int axis, float cmin, float scale, int bins, int split_bin) {
+    int i = start;
+    int j = end - 1;
+    while (i <= j) {
+        if (sah_bin_index(vec3_axis(prims[i].centroid, axis), cmin, scale, bins) <= split_bin) i++;
+        else {
+            PrimInfo temp = prims[i];
+            prims[i] = prims[j];
+            prims[j] = temp;
+            j--;
+        }
+    }
+    return i;
+}
+
+typedef struct {
+    const PrimInfo* prims;
+    int start;
+    AABB centroid_bounds;
+    int bins;
+    BoundsResult* bounds;
+    BinningResult* binned;
+} BinningTask;
+
+static void bounds_range(void* arg, int thread, int begin, int end) {
+    BinningTask* task = (BinningTask*)arg;
+    BoundsResult* out = &task->bounds[thread];
+    out->bounds = aabb_empty();
+    out->centroid_bounds = aabb_empty();
+    for (int i = task->start + begin; i < task->start + end; i++) {
+        out->bounds = aabb_union(out->bounds, task->prims[i].bounds);
+        out->centroid_bounds = aabb_extend(out->centroid_bounds, task->prims[i].centroid);
+    }
+}
+
+static void bin_range(void* arg, int thread, int begin, int end) {
+    BinningTask* task = (BinningTask*)arg;
+    BinningResult* out = &task->binned[thread];
+    int bins = task->bins;
+    float cmin[3] = {0}, scale[3] = {0};
+    for (int axis = 0; axis < 3; axis++) {
+        cmin[axis] = vec3_axis(task->centroid_bounds.min, axis);
+        float extent = vec3_axis(task->centroid_bounds.max, axis) - cmin[axis];
+        scale[axis] = extent > 0.0f ? bins / extent : 0.0f;
+        for (int b = 0; b < bins; b++) {
+            out->bins[axis][b].bounds = aabb_empty();
+            out->bins[axis][b].count = 0;
+        }
+    }
+    for (int i = task->start + begin; i < task->start + end; i++) {
+        const PrimInfo* p = &task->prims[i];
+        for (int axis = 0; axis < 3; axis++) {
+            SAHBin* bin = &out->bins[axis][sah_bin_index(vec3_axis(p->centroid, axis), cmin[axis], scale[axis], bins)];
+            bin->count++;
+            bin->bounds = aabb_union(bin->bounds, p->bounds);
+        }
+    }
+}
+
+static int build_threads(int count, int threads) {
+    int max_threads = count / PARALLEL_BUILD_MIN_PRIMS;
+    if (threads > max_threads) threads = max_threads;
+    return threads < 1 ? 1 : threads;
+}
+
+static void compute_bounds(const PrimInfo* prims, int start, int end, int threads, AABB* bounds, AABB* centroid_bounds) {
+    BoundsResult partial[MAX_BUILD_THREADS];
+    BinningTask task = {.prims = prims, .start = start, .bounds = partial};
+    threads = build_threads(end - start, threads);
+    parallel_for(end - start, threads, PARALLEL_BUILD_MIN_PRIMS, bounds_range, &task);
+    *bounds = partial[0].bounds;
+    *centroid_bounds = partial[0].centroid_bounds;
+    for (int t = 1; t < threads; t++) {
+        *bounds = aabb_union(*bounds, partial[t].bounds);
+        *centroid_bounds = aabb_union(*centroid_bounds, partial[t].centroid_bounds);
+    }
+}
+
+static void bin_prims(const PrimInfo* prims, int start, int end, AABB centroid_bounds, int bins, int threads, BinningResult* out) {
+    threads = build_threads(end - start, threads);
+    BinningTask task = {prims, start, centroid_bounds, bins, NULL, out};
+    if (threads == 1) {
+        bin_range(&task, 0, 0, end - start);
+        return;
+    }
+    BinningResult* partial = (BinningResult*)malloc(sizeof(BinningResult) * threads);
+    task.binned = partial;
+    parallel_for(end - start, threads, PARALLEL_BUILD_MIN_PRIMS, bin_range, &task);
+    *out = partial[0];
+    for (int t = 1; t < threads; t++) {
+        for (int axis = 0; axis < 3; axis++) {
+            for (int b = 0; b < bins; b++) {
+                out->bins[axis][b].count += partial[t].bins[axis][b].count;
+                out->bins[axis][b].bounds = aabb_union(out->bins[axis][b].bounds, partial[t].bins[axis][b].bounds);
+            }
+        }
+    }
+    free(partial);
+}
+
+SAHSplit bvh_find_sah_split(const BVHBuildOptions* opt, const PrimInfo* prims, int start, int end,
+                            AABB bounds, AABB centroid_bounds, int bins, int threads) {
+    BinningResult binned;
+    bin_prims(prims, start, end, centroid_bounds, bins, threads, &binned);
+
+    float inv_area = 1.0f / fmaxf(aabb_surface_area(bounds), 1e-12f);
+    SAHSplit best = {-1, -1, MAX_FLOAT, aabb_empty(), aabb_empty()};
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = vec3_axis(centroid_bounds.max, axis) - vec3_axis(centroid_bounds.min, axis);
+        if (extent <= 0.0f) continue;
+        const SAHBin* bin = binned.bins[axis];
+
+        AABB right_bounds[MAX_SAH_BINS];
+        float right_area[MAX_SAH_BINS];
+        int right_count[MAX_SAH_BINS];
+        AABB acc = aabb_empty();
+        int n = 0;
+        for (int b = bins - 1; b > 0; b--) {
+            acc = aabb_union(acc, bin[b].bounds);
+            n += bin[b].count;
+            right_bounds[b] = acc;
+            right_area[b] = aabb_surface_area(acc);
+            right_count[b] = n;
+        }
+
+        acc = aabb_empty();
+        n = 0;
+        for (int b = 0; b < bins - 1; b++) {
+            acc = aabb_union(acc, bin[b].bounds);
+            n += bin[b].count;
+            if (n == 0 || right_count[b + 1] == 0) continue;
+            float cost = opt->traversal_cost + opt->intersection_cost * inv_area *
+                         (n * aabb_surface_area(acc) + right_count[b + 1] * right_area[b + 1]);
+            if (cost < best.cost) best = (SAHSplit){axis, b, cost, acc, right_bounds[b + 1]};
+        }
+    }
+    return best;
+}
+
+static BVHBuildNode* build_sah(BuildContext* ctx, PrimInfo* prims, int start, int end, int threads);
+
+typedef struct {
+    BuildContext* ctx;
+    PrimInfo* prims;
+    int start, end, threads;
+    BVHBuildNode* result;
+} SubtreeTask;
+
+static void* build_subtree(void* arg) {
+    SubtreeTask* task = (SubtreeTask*)arg;
+    task->result = build_sah(task->ctx, task->prims, task->start, task->end, task->threads);
+    return NULL;
+}
+
+static BVHBuildNode* build_sah(BuildContext* ctx, PrimInfo* prims, int start, int end, int threads) {
+    const BVHBuildOptions* opt = ctx->options;
+    BVHBuildNode* node = alloc_node(ctx);
+
+    AABB bounds, centroid_bounds;
+    compute_bounds(prims, start, end, threads, &bounds, &centroid_bounds);
+    node->bounds = bounds;
+
+    int count = end - start;
+    if (count == 1) return make_leaf(ctx, node, prims, start, end);
+
+    int bins = opt->sah_bins < 2 ? 2 : (opt->sah_bins > MAX_SAH_BINS ? MAX_SAH_BINS : opt->sah_bins);
+    SAHSplit best = bvh_find_sah_split(opt, prims, start, end, bounds, centroid_bounds, bins, threads);
+
+    float leaf_cost = opt->intersection_cost * count;
+    if (count <= opt->max_leaf_prims && count <= BVH_MAX_LEAF_PRIMS && (best.axis < 0 || leaf_cost <= best.cost)) {
+        return make_leaf(ctx, node, prims, start, end);
+    }
+
+    int split;
+    if (best.axis < 0) {
+        split = start + count / 2;
+    } else {
+        float cmin = vec3_axis(centroid_bounds.min, best.axis);
+        float scale = bins / (vec3_axis(centroid_bounds.max, best.axis) - cmin);
+        split = partition_bins(prims, start, end, best.axis, cmin, scale, bins, best.bin);
+        if (split == start || split == end) split = start + count / 2;
+        node->axis = best.axis;
+    }
+
+    int left_threads = threads / 2;
+    pthread_t thread;
+    SubtreeTask left = {ctx, prims, start, split, left_threads, NULL};
+    if (left_threads >= 1 && split - start >= PARALLEL_BUILD_MIN_PRIMS && end - split >= PARALLEL_BUILD_MIN_PRIMS &&
+        pthread_create(&thread, NULL, build_subtree, &left) == 0) {
+        node->children[1] = build_sah(ctx, prims, split, end, threads - left_threads);
+        pthread_join(thread, NULL);
+        node->children[0] = left.result;
+    } else {
+        node->children[0] = build_sah(ctx, prims, start, split, threads);
+        node->children[1] = build_sah(ctx, prims, split, end, threads);
+    }
     return node;
 }
 
-void bvh_build(BVH* bvh, Triangle* triangles, int count) {
-    bvh->triangles = triangles;
-    bvh->tri_count = count;
-    bvh->prim_indices = (int*)malloc(sizeof(int) * count);
+typedef struct {
+    PrimInfo* prims;
+    const TriangleMesh* mesh;
+} PrimInfoTask;
+
+static void prim_info_range(void* arg, int thread, int begin, int end) {
+    (void)thread;
+    PrimInfoTask* task = (PrimInfoTask*)arg;
+    for (int i = begin; i < end; i++) {
+        Vec3 v[4];
+        int n = mesh_prim_vertices(task->mesh, i, v);
+        Vec3 sum = v[0];
+        for (int k = 1; k < n; k++) sum = vec3_add(sum, v[k]);
+        task->prims[i].index = i;
+        task->prims[i].bounds = prim_bounds(task->mesh, i);
+        task->prims[i].centroid = vec3_scale(sum, 1.0f / n);
+    }
+}
+
+static int flatten(BVHNode* nodes, const BVHBuildNode* node, int* offset) {
+    BVHNode* linear = &nodes[*offset];
+    int node_offset = (*offset)++;
+    linear->bounds = node->bounds;
+    linear->pad = 0;
+    if (node->prim_count > 0) {
+        linear->prim_offset = node->first_prim_offset;
+        linear->prim_count = (uint16_t)node->prim_count;
+        linear->axis = 0;
+    } else {
+        linear->axis = (uint8_t)node->axis;
+        linear->prim_count = 0;
+        flatten(nodes, node->children[0], offset);
+        linear->second_child_offset = flatten(nodes, node->children[1], offset);
+    }
+    return node_offset;
+}
+
+static void build_from_prims(BVH* bvh, PrimInfo* prims, int count, int max_refs, int threads) {
+    BuildContext ctx = {
+        .nodes = (BVHBuildNode*)malloc(sizeof(BVHBuildNode) * (2 * max_refs - 1)),
+        .node_count = 0,
+        .indices = bvh->prim_indices,
+        .index_count = count,
+        .mesh = &bvh->mesh,
+        .options = &bvh->options
+    };
+    BVHBuildNode* root;
+    switch (bvh->options.method) {
+        case BVH_BUILD_MIDPOINT: root = build_midpoint(&ctx, prims, 0, count); break;
+        case BVH_BUILD_LBVH: root = bvh_build_lbvh(&ctx, prims, count, threads); break;
+        case BVH_BUILD_SBVH: root = bvh_build_sbvh(&ctx, prims, count, max_refs); break;
+        default: root = build_sah(&ctx, prims, 0, count, threads); break;
+    }
+    if (bvh->options.treelet_passes > 0) {
+        struct timespec start, end;
+        float after;
+        timespec_get(&start, TIME_UTC);
+        bvh_optimize_treelets(&ctx, root, bvh->options.treelet_passes, threads, &bvh->unoptimized_sah_cost, &after);
+        timespec_get(&end, TIME_UTC);
+        bvh->optimize_seconds = (float)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9f;
+    }
+
+    int node_count = atomic_load(&ctx.node_count);
+    size_t bytes = ((sizeof(BVHNode) * node_count + 63) / 64) * 64;
+    bvh->nodes = (BVHNode*)aligned_alloc(64, bytes);
+    int offset = 0;
+    flatten(bvh->nodes, root, &offset);
+    bvh->node_count = node_count;
+    bvh->index_count = atomic_load(&ctx.index_count);
+    free(ctx.nodes);
+}
+
+static void update_tri_blocks(BVH* bvh) {
+    for (int i = 0; i < bvh->tri_block_count * 4; i++) {
+        TriangleBlock* b = &bvh->tri_blocks[i >> 2];
+        int lane = i & 3;
+        int idx = bvh->prim_indices[i];
+        b->prim[lane] = idx;
+        if (idx < 0) continue;
+        Vec3 v[4];
+        mesh_prim_vertices(&bvh->mesh, idx & ~BVH_QUAD_SECOND_HALF, v);
+        Vec3 v0 = v[0];
+        Vec3 e1 = vec3_sub((idx & BVH_QUAD_SECOND_HALF) ? v[2] : v[1], v0);
+        Vec3 e2 = vec3_sub((idx & BVH_QUAD_SECOND_HALF) ? v[3] : v[2], v0);
+        b->v0[0][lane] = v0.x; b->v0[1][lane] = v0.y; b->v0[2][lane] = v0.z;
+        b->e1[0][lane] = e1.x; b->e1[1][lane] = e1.y; b->e1[2][lane] = e1.z;
+        b->e2[0][lane] = e2.x; b->e2[1][lane] = e2.y; b->e2[2][lane] = e2.z;
+    }
+}
+
+static int leaf_slots(const BVH* bvh, const BVHNode* node) {
+    int slots = 0;
+    for (int k = 0; k < node->prim_count; k++) slots += bvh->prim_indices[node->prim_offset + k] < bvh->mesh.tri_count ? 1 : 2;
+    return slots;
+}
+
+// Repacks the reference list so every leaf starts on a multiple of four,
+// padding with -1, and fills one TriangleBlock per four slots. Quads expand
+// to two slots, so leaf prim counts become slot counts.
+static void build_tri_blocks(BVH* bvh) {
+    int slots = 0;
+    for (int i = 0; i < bvh->node_count; i++) {
+        if (bvh->nodes[i].prim_count > 0) slots += (leaf_slots(bvh, &bvh->nodes[i]) + 3) & ~3;
+    }
+    int* indices = (int*)malloc(sizeof(int) * (slots > 0 ? slots : 1));
+    int slot = 0;
+    for (int i = 0; i < bvh->node_count; i++) {
+        BVHNode* node = &bvh->nodes[i];
+        if (node->prim_count == 0) continue;
+        int count = 0;
+        for (int k = 0; k < node->prim_count; k++) {
+            int idx = bvh->prim_indices[node->prim_offset + k];
+            indices[slot + count++] = idx;
+            if (idx >= bvh->mesh.tri_count) indices[slot + count++] = idx | BVH_QUAD_SECOND_HALF;
+        }
+        assert(count <= UINT16_MAX);
+        int padded = (count + 3) & ~3;
+        for (int k = count; k < padded; k++) indices[slot + k] = -1;
+        node->prim_offset = slot;
+        node->prim_count = (uint16_t)count;
+        slot += padded;
+    }
+    free(bvh->prim_indices);
+    bvh->prim_indices = indices;
+    bvh->tri_block_count = slots / 4;
+    size_t bytes = ((sizeof(TriangleBlock) * bvh->tri_block_count + 63) / 64) * 64;
+    bvh->tri_blocks = (TriangleBlock*)aligned_alloc(64, bytes > 0 ? bytes : 64);
+    memset(bvh->tri_blocks, 0, sizeof(TriangleBlock) * bvh->tri_block_count);
+    update_tri_blocks(bvh);
+}
+
+static int init_bvh(BVH* bvh, const TriangleMesh* mesh, const BVHBuildOptions* options) {
+    bvh->options = options ? *options : bvh_default_options();
+    if (mesh) bvh->mesh = *mesh;
+    else memset(&bvh->mesh, 0, sizeof(TriangleMesh));
+    bvh->tri_count = mesh_prim_count(&bvh->mesh);
+    bvh->index_count = bvh->tri_count;
+    bvh->nodes = NULL;
+    bvh->node_count = 0;
+    bvh->tri_blocks = NULL;
+    bvh->tri_block_count = 0;
+    bvh->wide_nodes = NULL;
+    bvh->wide_node_count = 0;
+    bvh->width = 2;
+    bvh->isa = BVH_ISA_SCALAR;
+    bvh->compressed = false;
+    bvh->build_sah_cost = 0.0f;
+    bvh->unoptimized_sah_cost = 0.0f;
+    bvh->optimize_seconds = 0.0f;
+    bvh->mapping = NULL;
+    bvh->mapping_size = 0;
+    int threads = bvh->options.num_threads;
+    if (threads < 1) threads = 1;
+    if (threads > MAX_BUILD_THREADS) threads = MAX_BUILD_THREADS;
+    return threads;
+}
+
+void bvh_build(BVH* bvh, const TriangleMesh* mesh, const BVHBuildOptions* options) {
+    int threads = init_bvh(bvh, mesh, options);
+    int count = bvh->tri_count;
+    int max_refs = count;
+    if (bvh->options.method == BVH_BUILD_SBVH && bvh->options.max_duplication > 0.0f) {
+        max_refs += (int)(count * bvh->options.max_duplication);
+    }
+    bvh->prim_indices = (int*)malloc(sizeof(int) * (max_refs > 0 ? max_refs : 1));
+    if (count <= 0) return;
+
+    PrimInfo* prims = (PrimInfo*)malloc(sizeof(PrimInfo) * count);
+    PrimInfoTask info = {prims, &bvh->mesh};
+    parallel_for(count, threads, PARALLEL_BUILD_MIN_PRIMS, prim_info_range, &info);
+    build_from_prims(bvh, prims, count, max_refs, threads);
+    free(prims);
+    build_tri_blocks(bvh);
+
+    bvh->build_sah_cost = bvh_sah_cost(bvh);
+    bvh_build_wide(bvh);
+}
+
+void bvh_build_boxes(BVH* bvh, const AABB* boxes, int count, const BVHBuildOptions* options) {
+    int threads = init_bvh(bvh, NULL, options);
+    if (bvh->options.method == BVH_BUILD_SBVH) bvh->options.method = BVH_BUILD_SAH;
+    bvh->index_count = count > 0 ? count : 0;
+    bvh->prim_indices = (int*)malloc(sizeof(int) * (count > 0 ? count : 1));
+    if (count <= 0) return;
 
     PrimInfo* prims = (PrimInfo*)malloc(sizeof(PrimInfo) * count);
     for (int i = 0; i < count; i++) {
         prims[i].index = i;
-        prims[i].bounds = triangle_bounds(triangles[i]);
-        prims[i].centroid = vec3_scale(vec3_add(triangles[i].v0, vec3_add(triangles[i].v1, triangles[i].v2)), 1.0f/3.0f);
+        prims[i].bounds = boxes[i];
+        prims[i].centroid = vec3_scale(vec3_add(boxes[i].min, boxes[i].max), 0.5f);
     }
-    
-    int total_nodes = 0;
-    bvh->nodes = build_recursive(prims, 0, count, &total_nodes, triangles, bvh->prim_indices);
-    bvh->node_count = total_nodes;
+    build_from_prims(bvh, prims, count, count, threads);
     free(prims);
+    bvh->build_sah_cost = bvh_sah_cost(bvh);
 }
 
-static bool intersect_aabb(AABB bounds, Ray r, float t_min, float t_max) {
-    float t0 = t_min, t1 = t_max;
-    for (int i = 0; i < 3; i++) {
-        float invD = 1.0f / ((float*)&r.direction)[i];
-        float tNear = (((float*)&bounds.min)[i] - ((float*)&r.origin)[i]) * invD;
-        float tFar = (((float*)&bounds.max)[i] - ((float*)&r.origin)[i]) * invD;
-        if (invD < 0.0f) { float tmp = tNear; tNear = tFar; tFar = tmp; }
-        t0 = tNear > t0 ? tNear : t0;
-        t1 = tFar < t1 ? tFar : t1;
-        if (t1 <= t0) return false;
-    }
-    return true;
+size_t bvh_node_bytes(const BVH* bvh) {
+    if (!bvh->wide_nodes) return sizeof(BVHNode) * bvh->node_count;
+    size_t node_size = bvh->compressed ? sizeof(BVH4QNode) : (bvh->width == 4 ? sizeof(BVH4Node) : sizeof(BVH8Node));
+    return node_size * bvh->wide_node_count;
 }
 
-static bool intersect_triangle(Triangle tri, Ray r, float t_min, float t_max, float* t, float* u, float* v) {
-    Vec3 e1 = vec3_sub(tri.v1, tri.v0);
-    Vec3 e2 = vec3_sub(tri.v2, tri.v0);
-    Vec3 h = vec3_cross(r.direction, e2);
-    float a = vec3_dot(e1, h);
-    if (a > -EPSILON && a < EPSILON) return false;
-    
-    float f = 1.0f / a;
-    Vec3 s = vec3_sub(r.origin, tri.v0);
-    *u = f * vec3_dot(s, h);
-    if (*u < 0.0f || *u > 1.0f) return false;
-    
-    Vec3 q = vec3_cross(s, e1);
-    *v = f * vec3_dot(r.direction, q);
-    if (*v < 0.0f || *u + *v > 1.0f) return false;
-    
-    float temp_t = f * vec3_dot(e2, q);
-    if (temp_t > t_min && temp_t < t_max) {
-        *t = temp_t;
+size_t bvh_leaf_bytes(const BVH* bvh) {
+    return sizeof(TriangleBlock) * bvh->tri_block_count;
+}
+
+bool bvh_refit(BVH* bvh) {
+    if (!bvh->nodes || !bvh->mesh.positions) return false;
+    for (int i = bvh->node_count - 1; i >= 0; i--) {
+        BVHNode* node = &bvh->nodes[i];
+        if (node->prim_count > 0) {
+            AABB bounds = aabb_empty();
+            for (int k = 0; k < node->prim_count; k++) {
+                bounds = aabb_union(bounds, prim_bounds(&bvh->mesh, bvh->prim_indices[node->prim_offset + k]));
+            }
+            node->bounds = bounds;
+        } else {
+            node->bounds = aabb_union(bvh->nodes[i + 1].bounds, bvh->nodes[node->second_child_offset].bounds);
+        }
+    }
+
+    float ratio = bvh->options.refit_rebuild_ratio;
+    if (ratio > 0.0f && bvh_sah_cost(bvh) > bvh->build_sah_cost * ratio) {
+        BVHBuildOptions options = bvh->options;
+        TriangleMesh mesh = bvh->mesh;
+        bvh_free(bvh);
+        bvh_build(bvh, &mesh, &options);
         return true;
     }
+    update_tri_blocks(bvh);
+    bvh_refit_wide(bvh);
     return false;
 }
 
+float bvh_sah_cost(const BVH* bvh) {
+    if (!bvh->nodes) return 0.0f;
+    float root_area = aabb_surface_area(bvh->nodes[0].bounds);
+    if (root_area <= 0.0f) return 0.0f;
+    float cost = 0.0f;
+    for (int i = 0; i < bvh->node_count; i++) {
+        const BVHNode* node = &bvh->nodes[i];
+        float area = aabb_surface_area(node->bounds);
+        cost += (node->prim_count > 0) ? bvh->options.intersection_cost * node->prim_count * area
+                                       : bvh->options.traversal_cost * area;
+    }
+    return cost / root_area;
+}
+
 bool bvh_intersect(const BVH* bvh, Ray r, float t_min, float t_max, float* t, int* tri_index, float* u, float* v) {
+    if (!bvh->nodes) return false;
+    if (bvh->wide_nodes) {
+        bool hit = bvh_intersect_wide(bvh, r, t_min, t_max, t, tri_index, u, v);
+        if (hit) resolve_quad_hit(bvh, tri_index, u, v);
+        return hit;
+    }
     bool hit = false;
     float closest_t = t_max;
-    const BVHNode* stack[64];
+    Vec3 inv_dir = {safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+    int dir_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+    int stack[64];
     int stack_ptr = 0;
-    stack[stack_ptr++] = bvh->nodes;
+    int current = 0;
     
-    while (stack_ptr > 0) {
-        const BVHNode* node = stack[--stack_ptr];
-        if (!intersect_aabb(node->bounds, r, t_min, closest_t)) continue;
-        
-        if (node->prim_count > 0) {
-            for (int i = 0; i < node->prim_count; i++) {
-                int idx = bvh->prim_indices[node->first_prim_offset + i];
-                float temp_u, temp_v, temp_t;
-                if (intersect_triangle(bvh->triangles[idx], r, t_min, closest_t, &temp_t, &temp_u, &temp_v)) {
-                    closest_t = temp_t;
+    while (true) {
+        const BVHNode* node = &bvh->nodes[current];
+        if (intersect_aabb(&node->bounds, r.origin, inv_dir, dir_neg, t_min, closest_t)) {
+            if (node->prim_count > 0) {
+                if (intersect_leaf(bvh, r, node->prim_offset, node->prim_count, t_min, &closest_t, tri_index, u, v)) {
                     *t = closest_t;
-                    *u = temp_u;
-                    *v = temp_v;
-                    *tri_index = idx;
                     hit = true;
                 }
+                if (stack_ptr == 0) break;
+                current = stack[--stack_ptr];
+            } else if (dir_neg[node->axis]) {
+                stack[stack_ptr++] = current + 1;
+                current = node->second_child_offset;
+            } else {
+                stack[stack_ptr++] = node->second_child_offset;
+                current = current + 1;
             }
         } else {
-            stack[stack_ptr++] = node->left;
-            stack[stack_ptr++] = node->right;
+            if (stack_ptr == 0) break;
+            current = stack[--stack_ptr];
         }
     }
+    if (hit) resolve_quad_hit(bvh, tri_index, u, v);
     return hit;
 }
 
+bool bvh_occluded(const BVH* bvh, Ray r, float t_min, float t_max) {
+    if (!bvh->nodes) return false;
+    if (bvh->wide_nodes) return bvh_occluded_wide(bvh, r, t_min, t_max);
+    Vec3 inv_dir = {safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+    int dir_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+    int stack[64];
+    int stack_ptr = 0;
+    int current = 0;
+
+    while (true) {
+        const BVHNode* node = &bvh->nodes[current];
+        if (intersect_aabb(&node->bounds, r.origin, inv_dir, dir_neg, t_min, t_max)) {
+            if (node->prim_count > 0) {
+                if (occluded_leaf(bvh, r, node->prim_offset, node->prim_count, t_min, t_max)) return true;
+                if (stack_ptr == 0) break;
+                current = stack[--stack_ptr];
+            } else {
+                stack[stack_ptr++] = node->second_child_offset;
+                current = current + 1;
+            }
+        } else {
+            if (stack_ptr == 0) break;
+            current = stack[--stack_ptr];
+        }
+    }
+    return false;
+}
+
 void bvh_free(BVH* bvh) {
+    if (bvh->mapping) {
+        bvh_cache_unmap(bvh);
+        return;
+    }
+    free(bvh->nodes);
+    free(bvh->wide_nodes);
     free(bvh->prim_indices);
+    free(bvh->tri_blocks);
+    bvh->nodes = NULL;
+    bvh->tri_blocks = NULL;
+    bvh->wide_nodes = NULL;
+    bvh->prim_indices = NULL;
 }
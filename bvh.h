@@ -3,34 +3,130 @@
 
 #include "types.h"
 #include "ray.h"
+#include "mesh.h"
+#include <stddef.h>
 
-typedef struct {
-    Vec3 v0, v1, v2;
-    Vec3 n0, n1, n2;
-    int material_id;
-} Triangle;
+#define BVH_MAX_PACKET 16
 
 typedef struct { Vec3 min, max; } AABB;
 
-typedef struct BVHNode {
+typedef struct {
     AABB bounds;
-    struct BVHNode* left;
-    struct BVHNode* right;
-    int first_prim_offset;
-    int prim_count;
-    int axis;
+    union {
+        int prim_offset;
+        int second_child_offset;
+    };
+    uint16_t prim_count;
+    uint8_t axis;
+    uint8_t pad;
 } BVHNode;
 
+_Static_assert(sizeof(BVHNode) == 32, "BVHNode must stay 32 bytes");
+
+typedef struct {
+    float bounds[6][4];
+    int32_t child[4];
+    uint16_t prim_count[4];
+    uint8_t child_count;
+    uint8_t pad[7];
+} BVH4Node;
+
+typedef struct {
+    float bounds[6][8];
+    int32_t child[8];
+    uint16_t prim_count[8];
+    uint8_t child_count;
+    uint8_t pad[15];
+} BVH8Node;
+
+// 4-wide node with child bounds quantized to 8 bits on a per-axis
+// power-of-two grid anchored at origin: bound = origin + q * 2^exponent.
+typedef struct {
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t child_count;
+    uint8_t lo[3][4];
+    uint8_t hi[3][4];
+    int32_t child[4];
+    uint16_t prim_count[4];
+} BVH4QNode;
+
+// Leaf triangles in SoA form, four per block, with the edges from v0
+// precomputed. Lanes past the end of a leaf are zero and never hit. A quad
+// fills two lanes with its halves (v0, v1, v2) and (v0, v2, v3); the second
+// lane's prim carries BVH_QUAD_SECOND_HALF, as does its prim_indices slot.
+#define BVH_QUAD_SECOND_HALF 0x40000000
+
+typedef struct {
+    float v0[3][4];
+    float e1[3][4];
+    float e2[3][4];
+    int32_t prim[4];
+} TriangleBlock;
+
+_Static_assert(sizeof(BVH4Node) == 128, "BVH4Node must stay 128 bytes");
+_Static_assert(sizeof(BVH4QNode) == 64, "BVH4QNode must stay 64 bytes");
+_Static_assert(sizeof(BVH8Node) == 256, "BVH8Node must stay 256 bytes");
+_Static_assert(sizeof(TriangleBlock) == 160, "TriangleBlock must stay 160 bytes");
+
+typedef enum { BVH_BUILD_MIDPOINT, BVH_BUILD_SAH, BVH_BUILD_LBVH, BVH_BUILD_SBVH } BVHBuildMethod;
+
+typedef struct {
+    BVHBuildMethod method;
+    int sah_bins;
+    float traversal_cost;
+    float intersection_cost;
+    int max_leaf_prims;
+    int width;
+    int num_threads;
+    int morton_bits;
+    float max_duplication;
+    float spatial_split_alpha;
+    float refit_rebuild_ratio;
+    bool compress_nodes;
+    int treelet_passes;
+} BVHBuildOptions;
+
+typedef enum { BVH_ISA_SCALAR, BVH_ISA_SSE, BVH_ISA_AVX } BVHIsa;
+
 typedef struct {
     BVHNode* nodes;
     int* prim_indices;
-    Triangle* triangles;
+    TriangleMesh mesh;
     int node_count;
     int tri_count;
+    int index_count;
+    TriangleBlock* tri_blocks;
+    int tri_block_count;
+    void* wide_nodes;
+    int wide_node_count;
+    int width;
+    BVHIsa isa;
+    bool compressed;
+    float build_sah_cost;
+    float unoptimized_sah_cost;
+    float optimize_seconds;
+    BVHBuildOptions options;
+    void* mapping;
+    size_t mapping_size;
 } BVH;
 
-void bvh_build(BVH* bvh, Triangle* triangles, int count);
+BVHBuildOptions bvh_default_options(void);
+void bvh_build(BVH* bvh, const TriangleMesh* mesh, const BVHBuildOptions* options);
+void bvh_build_boxes(BVH* bvh, const AABB* boxes, int count, const BVHBuildOptions* options);
+bool bvh_refit(BVH* bvh);
+float bvh_sah_cost(const BVH* bvh);
+size_t bvh_node_bytes(const BVH* bvh);
+size_t bvh_leaf_bytes(const BVH* bvh);
+const char* bvh_method_name(BVHBuildMethod method);
+const char* bvh_isa_name(BVHIsa isa);
 bool bvh_intersect(const BVH* bvh, Ray r, float t_min, float t_max, float* t, int* tri_index, float* u, float* v);
+void bvh_intersect_packet(const BVH* bvh, const Ray* rays, int count, float t_min, float t_max,
+                          float* t, int* tri_index, float* u, float* v);
+bool bvh_occluded(const BVH* bvh, Ray r, float t_min, float t_max);
+uint64_t bvh_content_hash(const TriangleMesh* mesh, const BVHBuildOptions* options);
+bool bvh_save(const BVH* bvh, const char* path);
+bool bvh_load(BVH* bvh, const char* path, const TriangleMesh* mesh, const BVHBuildOptions* options);
 void bvh_free(BVH* bvh);
 
 #endif
@@ -0,0 +1,203 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bvh_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BVH_CACHE_MAGIC "PTBVH\0\0\0"
+#define BVH_CACHE_VERSION 3
+#define BVH_CACHE_ENDIAN 0x01020304u
+#define BVH_CACHE_ALIGN 64
+
+// Sections are addressed by byte offsets from the start of the file, so
+// the mapping can live at any address.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t header_size;
+    uint32_t node_size;
+    uint32_t wide_node_size;
+    uint32_t block_size;
+    uint64_t hash;
+    int32_t tri_count;
+    int32_t node_count;
+    int32_t index_count;
+    int32_t index_slots;
+    int32_t tri_block_count;
+    int32_t wide_node_count;
+    int32_t width;
+    int32_t compressed;
+    float build_sah_cost;
+    float pad;
+    uint64_t nodes_offset;
+    uint64_t indices_offset;
+    uint64_t blocks_offset;
+    uint64_t wide_offset;
+    uint64_t file_size;
+} BVHCacheHeader;
+
+static inline uint64_t hash_mix(uint64_t h, uint64_t w) {
+    h ^= w * 0x9e3779b97f4a7c15ULL;
+    h = (h << 31) | (h >> 33);
+    return h * 0xff51afd7ed558ccdULL;
+}
+
+static uint64_t hash_bytes(uint64_t h, const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*)data;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = hash_mix(h, w);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + i, size - i);
+    return hash_mix(h, tail ^ size);
+}
+
+uint64_t bvh_content_hash(const TriangleMesh* mesh, const BVHBuildOptions* options) {
+    BVHBuildOptions o = options ? *options : bvh_default_options();
+    uint64_t h = hash_bytes(0x243f6a8885a308d3ULL, mesh->positions, sizeof(Vec3) * (size_t)mesh->vertex_count);
+    h = hash_bytes(h, mesh->indices, sizeof(uint32_t) * 3 * (size_t)mesh->tri_count);
+    if (mesh->quad_count > 0) h = hash_bytes(h, mesh->quad_indices, sizeof(uint32_t) * 4 * (size_t)mesh->quad_count);
+    int ints[] = {o.method, o.sah_bins, o.max_leaf_prims, o.width, o.morton_bits, o.compress_nodes, o.treelet_passes};
+    float floats[] = {o.traversal_cost, o.intersection_cost, o.max_duplication, o.spatial_split_alpha};
+    h = hash_bytes(h, ints, sizeof(ints));
+    return hash_bytes(h, floats, sizeof(floats));
+}
+
+static size_t wide_node_size(const BVH* bvh) {
+    if (bvh->compressed) return sizeof(BVH4QNode);
+    return bvh->width == 8 ? sizeof(BVH8Node) : sizeof(BVH4Node);
+}
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + BVH_CACHE_ALIGN - 1) / BVH_CACHE_ALIGN * BVH_CACHE_ALIGN;
+}
+
+static bool write_section(FILE* f, uint64_t offset, const void* data, size_t size) {
+    static const char zeros[BVH_CACHE_ALIGN] = {0};
+    long pos = ftell(f);
+    if (pos < 0 || (uint64_t)pos > offset) return false;
+    if (fwrite(zeros, 1, offset - (uint64_t)pos, f) != offset - (uint64_t)pos) return false;
+    return size == 0 || fwrite(data, 1, size, f) == size;
+}
+
+bool bvh_save(const BVH* bvh, const char* path) {
+    if (!bvh->nodes) return false;
+    BVHCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BVH_CACHE_MAGIC, 8);
+    h.version = BVH_CACHE_VERSION;
+    h.endian = BVH_CACHE_ENDIAN;
+    h.header_size = sizeof(BVHCacheHeader);
+    h.node_size = sizeof(BVHNode);
+    h.wide_node_size = bvh->wide_nodes ? (uint32_t)wide_node_size(bvh) : 0;
+    h.block_size = sizeof(TriangleBlock);
+    h.hash = bvh_content_hash(&bvh->mesh, &bvh->options);
+    h.tri_count = bvh->tri_count;
+    h.node_count = bvh->node_count;
+    h.index_count = bvh->index_count;
+    h.index_slots = bvh->tri_blocks ? bvh->tri_block_count * 4 : bvh->index_count;
+    h.tri_block_count = bvh->tri_blocks ? bvh->tri_block_count : 0;
+    h.wide_node_count = bvh->wide_nodes ? bvh->wide_node_count : 0;
+    h.width = bvh->width;
+    h.compressed = bvh->compressed;
+    h.build_sah_cost = bvh->build_sah_cost;
+    h.nodes_offset = align_offset(sizeof(BVHCacheHeader));
+    h.indices_offset = align_offset(h.nodes_offset + sizeof(BVHNode) * (uint64_t)h.node_count);
+    h.blocks_offset = align_offset(h.indices_offset + sizeof(int) * (uint64_t)h.index_slots);
+    h.wide_offset = align_offset(h.blocks_offset + sizeof(TriangleBlock) * (uint64_t)h.tri_block_count);
+    h.file_size = h.wide_offset + (uint64_t)h.wide_node_size * h.wide_node_count;
+
+    // Written under a temporary name and renamed so concurrent jobs never
+    // map a partially written file.
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%ld", path, (long)getpid());
+    FILE* f = fopen(tmp_path, "wb");
+    if (!f) return false;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+              write_section(f, h.nodes_offset, bvh->nodes, sizeof(BVHNode) * (size_t)h.node_count) &&
+              write_section(f, h.indices_offset, bvh->prim_indices, sizeof(int) * (size_t)h.index_slots) &&
+              write_section(f, h.blocks_offset, bvh->tri_blocks, sizeof(TriangleBlock) * (size_t)h.tri_block_count) &&
+              write_section(f, h.wide_offset, bvh->wide_nodes, (size_t)h.wide_node_size * h.wide_node_count);
+    ok = (fclose(f) == 0) && ok;
+    if (ok) ok = rename(tmp_path, path) == 0;
+    if (!ok) remove(tmp_path);
+    return ok;
+}
+
+static bool header_valid(const BVHCacheHeader* h, size_t file_size, uint64_t hash, int count) {
+    if (memcmp(h->magic, BVH_CACHE_MAGIC, 8) != 0 || h->version != BVH_CACHE_VERSION) return false;
+    if (h->endian != BVH_CACHE_ENDIAN || h->header_size != sizeof(BVHCacheHeader)) return false;
+    if (h->node_size != sizeof(BVHNode) || h->block_size != sizeof(TriangleBlock) || h->hash != hash || h->tri_count != count) return false;
+    if (h->file_size != file_size || h->node_count <= 0 || h->index_count < 0 || h->wide_node_count < 0) return false;
+    if (h->index_slots < h->index_count || h->tri_block_count < 0 || h->tri_block_count * 4 > h->index_slots) return false;
+    if (h->width != 2 && h->width != 4 && h->width != 8) return false;
+    if (h->nodes_offset % BVH_CACHE_ALIGN || h->indices_offset % BVH_CACHE_ALIGN) return false;
+    if (h->blocks_offset % BVH_CACHE_ALIGN || h->wide_offset % BVH_CACHE_ALIGN) return false;
+    return h->nodes_offset + sizeof(BVHNode) * (uint64_t)h->node_count <= h->indices_offset &&
+           h->indices_offset + sizeof(int) * (uint64_t)h->index_slots <= h->blocks_offset &&
+           h->blocks_offset + sizeof(TriangleBlock) * (uint64_t)h->tri_block_count <= h->wide_offset &&
+           h->wide_offset + (uint64_t)h->wide_node_size * h->wide_node_count <= file_size;
+}
+
+bool bvh_load(BVH* bvh, const char* path, const TriangleMesh* mesh, const BVHBuildOptions* options) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BVHCacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    // A private writable mapping lets bvh_refit update bounds copy-on-write
+    // without touching the file.
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const BVHCacheHeader* h = (const BVHCacheHeader*)map;
+    BVHBuildOptions opt = options ? *options : bvh_default_options();
+    if (!header_valid(h, size, bvh_content_hash(mesh, &opt), mesh_prim_count(mesh)) ||
+        (h->wide_node_count > 0 && h->wide_node_size != (h->compressed ? sizeof(BVH4QNode) : (h->width == 8 ? sizeof(BVH8Node) : sizeof(BVH4Node))))) {
+        munmap(map, size);
+        return false;
+    }
+
+    char* base = (char*)map;
+    bvh->options = opt;
+    bvh->mesh = *mesh;
+    bvh->tri_count = mesh_prim_count(mesh);
+    bvh->nodes = (BVHNode*)(base + h->nodes_offset);
+    bvh->node_count = h->node_count;
+    bvh->prim_indices = (int*)(base + h->indices_offset);
+    bvh->index_count = h->index_count;
+    bvh->tri_blocks = h->tri_block_count > 0 ? (TriangleBlock*)(base + h->blocks_offset) : NULL;
+    bvh->tri_block_count = h->tri_block_count;
+    bvh->wide_nodes = h->wide_node_count > 0 ? base + h->wide_offset : NULL;
+    bvh->wide_node_count = h->wide_node_count;
+    bvh->width = bvh->wide_nodes ? h->width : 2;
+    bvh->compressed = h->compressed != 0;
+    bvh->isa = bvh_wide_isa(bvh->width);
+    bvh->build_sah_cost = h->build_sah_cost;
+    bvh->unoptimized_sah_cost = 0.0f;
+    bvh->optimize_seconds = 0.0f;
+    bvh->mapping = map;
+    bvh->mapping_size = size;
+    return true;
+}
+
+void bvh_cache_unmap(BVH* bvh) {
+    munmap(bvh->mapping, bvh->mapping_size);
+    bvh->mapping = NULL;
+    bvh->mapping_size = 0;
+    bvh->nodes = NULL;
+    bvh->wide_nodes = NULL;
+    bvh->prim_indices = NULL;
+    bvh->tri_blocks = NULL;
+}
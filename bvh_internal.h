@@ -0,0 +1,263 @@
+#ifndef BVH_INTERNAL_H
+#define BVH_INTERNAL_H
+
+#include "bvh.h"
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BVH_X86 1
+#endif
+
+#define MAX_BUILD_THREADS 64
+#define PARALLEL_BUILD_MIN_PRIMS 4096
+#define MAX_SAH_BINS 64
+// BVHNode.prim_count is 16 bits and counts block slots once leaves are
+// packed, with quads taking two, so leaves hold at most half that many
+// primitives.
+#define BVH_MAX_LEAF_PRIMS (UINT16_MAX / 2)
+
+typedef struct {
+    int index;
+    AABB bounds;
+    Vec3 centroid;
+} PrimInfo;
+
+typedef struct BVHBuildNode {
+    AABB bounds;
+    struct BVHBuildNode* children[2];
+    int first_prim_offset;
+    int prim_count;
+    int axis;
+} BVHBuildNode;
+
+typedef struct {
+    BVHBuildNode* nodes;
+    atomic_int node_count;
+    int* indices;
+    atomic_int index_count;
+    const TriangleMesh* mesh;
+    const BVHBuildOptions* options;
+} BuildContext;
+
+typedef struct {
+    int axis;
+    int bin;
+    float cost;
+    AABB left, right;
+} SAHSplit;
+
+static inline AABB aabb_empty(void) {
+    return (AABB){{MAX_FLOAT, MAX_FLOAT, MAX_FLOAT}, {-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT}};
+}
+
+static inline AABB aabb_union(AABB a, AABB b) {
+    return (AABB){vec3_min(a.min, b.min), vec3_max(a.max, b.max)};
+}
+
+static inline AABB aabb_extend(AABB a, Vec3 p) {
+    return (AABB){vec3_min(a.min, p), vec3_max(a.max, p)};
+}
+
+static inline float aabb_surface_area(AABB b) {
+    Vec3 d = vec3_sub(b.max, b.min);
+    if (d.x < 0.0f || d.y < 0.0f || d.z < 0.0f) return 0.0f;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static inline float vec3_axis(Vec3 v, int axis) {
+    return (axis == 0) ? v.x : ((axis == 1) ? v.y : v.z);
+}
+
+static inline AABB prim_bounds(const TriangleMesh* mesh, int prim) {
+    Vec3 v[4];
+    int n = mesh_prim_vertices(mesh, prim & ~BVH_QUAD_SECOND_HALF, v);
+    AABB b = {v[0], v[0]};
+    for (int i = 1; i < n; i++) b = aabb_extend(b, v[i]);
+    return b;
+}
+
+// Maps a hit on either half of a quad to the quad's primitive id and its
+// (s, t) parameters: the first half covers s >= t, the second s < t.
+static inline void resolve_quad_hit(const BVH* bvh, int* prim, float* u, float* v) {
+    int id = *prim & ~BVH_QUAD_SECOND_HALF;
+    if (id < bvh->mesh.tri_count) return;
+    float a = *u, b = *v;
+    if (*prim & BVH_QUAD_SECOND_HALF) *v = a + b;
+    else *u = a + b;
+    *prim = id;
+}
+
+static inline int sah_bin_index(float c, float cmin, float scale, int bins) {
+    int b = (int)((c - cmin) * scale);
+    if (b < 0) b = 0;
+    if (b >= bins) b = bins - 1;
+    return b;
+}
+
+static inline AABB aabb_intersect(AABB a, AABB b) {
+    return (AABB){vec3_max(a.min, b.min), vec3_min(a.max, b.max)};
+}
+
+static inline float safe_rcp(float x) {
+    return 1.0f / (fabsf(x) > 1e-20f ? x : copysignf(1e-20f, x));
+}
+
+static inline bool intersect_aabb(const AABB* bounds, Vec3 origin, Vec3 inv_dir, const int dir_neg[3], float t_min, float t_max) {
+    const Vec3* b = (const Vec3*)bounds;
+    float tx0 = (b[dir_neg[0]].x - origin.x) * inv_dir.x;
+    float tx1 = (b[1 - dir_neg[0]].x - origin.x) * inv_dir.x;
+    float ty0 = (b[dir_neg[1]].y - origin.y) * inv_dir.y;
+    float ty1 = (b[1 - dir_neg[1]].y - origin.y) * inv_dir.y;
+    float tz0 = (b[dir_neg[2]].z - origin.z) * inv_dir.z;
+    float tz1 = (b[1 - dir_neg[2]].z - origin.z) * inv_dir.z;
+    float t0 = fmaxf(fmaxf(tx0, ty0), fmaxf(tz0, t_min));
+    float t1 = fminf(fminf(tx1, ty1), fminf(tz1, t_max));
+    return t0 <= t1;
+}
+
+#ifdef BVH_X86
+// Möller-Trumbore against the four lanes of a block at once. Returns the
+// mask of lanes hit inside (t_min, t_max); padding lanes are degenerate
+// and always rejected by the determinant test.
+static inline int intersect_block(const TriangleBlock* b, Ray r, float t_min, float t_max, __m128* t_out, __m128* u_out, __m128* v_out) {
+    __m128 dx = _mm_set1_ps(r.direction.x), dy = _mm_set1_ps(r.direction.y), dz = _mm_set1_ps(r.direction.z);
+    __m128 e1x = _mm_load_ps(b->e1[0]), e1y = _mm_load_ps(b->e1[1]), e1z = _mm_load_ps(b->e1[2]);
+    __m128 e2x = _mm_load_ps(b->e2[0]), e2y = _mm_load_ps(b->e2[1]), e2z = _mm_load_ps(b->e2[2]);
+
+    __m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+    __m128 mask = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), a), _mm_set1_ps(EPSILON));
+    if (!_mm_movemask_ps(mask)) return 0;
+
+    __m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+    __m128 sx = _mm_sub_ps(_mm_set1_ps(r.origin.x), _mm_load_ps(b->v0[0]));
+    __m128 sy = _mm_sub_ps(_mm_set1_ps(r.origin.y), _mm_load_ps(b->v0[1]));
+    __m128 sz = _mm_sub_ps(_mm_set1_ps(r.origin.z), _mm_load_ps(b->v0[2]));
+    __m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), _mm_cmple_ps(u, _mm_set1_ps(1.0f))));
+    if (!_mm_movemask_ps(mask)) return 0;
+
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    __m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+    __m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f))));
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(t_min)), _mm_cmplt_ps(t, _mm_set1_ps(t_max))));
+    *t_out = t;
+    *u_out = u;
+    *v_out = v;
+    return _mm_movemask_ps(mask);
+}
+#else
+static inline int intersect_block(const TriangleBlock* b, Ray r, float t_min, float t_max, float t_out[4], float u_out[4], float v_out[4]) {
+    int mask = 0;
+    for (int k = 0; k < 4; k++) {
+        Vec3 e1 = {b->e1[0][k], b->e1[1][k], b->e1[2][k]};
+        Vec3 e2 = {b->e2[0][k], b->e2[1][k], b->e2[2][k]};
+        Vec3 h = vec3_cross(r.direction, e2);
+        float a = vec3_dot(e1, h);
+        if (a > -EPSILON && a < EPSILON) continue;
+
+        float f = 1.0f / a;
+        Vec3 s = vec3_sub(r.origin, (Vec3){b->v0[0][k], b->v0[1][k], b->v0[2][k]});
+        float u = f * vec3_dot(s, h);
+        if (u < 0.0f || u > 1.0f) continue;
+
+        Vec3 q = vec3_cross(s, e1);
+        float v = f * vec3_dot(r.direction, q);
+        if (v < 0.0f || u + v > 1.0f) continue;
+
+        float t = f * vec3_dot(e2, q);
+        if (t > t_min && t < t_max) {
+            t_out[k] = t;
+            u_out[k] = u;
+            v_out[k] = v;
+            mask |= 1 << k;
+        }
+    }
+    return mask;
+}
+#endif
+
+// Leaves start on a block boundary (see build_tri_blocks), so a leaf
+// at prim_offset covers blocks prim_offset / 4 onwards. SBVH duplicates
+// are simply tested again: a repeated reference cannot change the closest
+// hit, and a per-ray mailbox could only skip a block whose four lanes were
+// all seen before, which almost never happens.
+static inline bool intersect_leaf(const BVH* bvh, Ray r, int offset, int count, float t_min, float* closest_t,
+                                  int* tri_index, float* u, float* v) {
+    bool hit = false;
+    const TriangleBlock* b = &bvh->tri_blocks[offset >> 2];
+    for (int i = 0; i < count; i += 4, b++) {
+#ifdef BVH_X86
+        __m128 t4, u4, v4;
+        int mask = intersect_block(b, r, t_min, *closest_t, &t4, &u4, &v4);
+        if (!mask) continue;
+        _Alignas(16) float lt[4], lu[4], lv[4];
+        _mm_store_ps(lt, t4);
+        _mm_store_ps(lu, u4);
+        _mm_store_ps(lv, v4);
+#else
+        float lt[4], lu[4], lv[4];
+        int mask = intersect_block(b, r, t_min, *closest_t, lt, lu, lv);
+#endif
+        while (mask) {
+            int k = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (lt[k] < *closest_t) {
+                *closest_t = lt[k];
+                *u = lu[k];
+                *v = lv[k];
+                *tri_index = b->prim[k];
+                hit = true;
+            }
+        }
+    }
+    return hit;
+}
+
+static inline bool occluded_leaf(const BVH* bvh, Ray r, int offset, int count, float t_min, float t_max) {
+    const TriangleBlock* b = &bvh->tri_blocks[offset >> 2];
+    for (int i = 0; i < count; i += 4, b++) {
+#ifdef BVH_X86
+        __m128 t4, u4, v4;
+        if (intersect_block(b, r, t_min, t_max, &t4, &u4, &v4)) return true;
+#else
+        float t4[4], u4[4], v4[4];
+        if (intersect_block(b, r, t_min, t_max, t4, u4, v4)) return true;
+#endif
+    }
+    return false;
+}
+
+static inline BVHBuildNode* alloc_node(BuildContext* ctx) {
+    BVHBuildNode* node = &ctx->nodes[atomic_fetch_add(&ctx->node_count, 1)];
+    memset(node, 0, sizeof(BVHBuildNode));
+    return node;
+}
+
+static inline BVHBuildNode* make_leaf(BuildContext* ctx, BVHBuildNode* node, PrimInfo* prims, int start, int end) {
+    node->first_prim_offset = start;
+    node->prim_count = end - start;
+    for (int i = start; i < end; ++i) ctx->indices[i] = prims[i].index;
+    return node;
+}
+
+SAHSplit bvh_find_sah_split(const BVHBuildOptions* opt, const PrimInfo* prims, int start, int end,
+                            AABB bounds, AABB centroid_bounds, int bins, int threads);
+BVHBuildNode* bvh_build_sbvh(BuildContext* ctx, PrimInfo* prims, int count, int max_refs);
+BVHBuildNode* bvh_build_lbvh(BuildContext* ctx, PrimInfo* prims, int count, int threads);
+void bvh_optimize_treelets(BuildContext* ctx, BVHBuildNode* root, int passes, int threads, float* sah_before, float* sah_after);
+void bvh_build_wide(BVH* bvh);
+BVHIsa bvh_wide_isa(int width);
+void bvh_cache_unmap(BVH* bvh);
+void bvh_refit_wide(BVH* bvh);
+bool bvh_occluded_wide(const BVH* bvh, Ray r, float t_min, float t_max);
+bool bvh_intersect_wide(const BVH* bvh, Ray r, float t_min, float t_max, float* t, int* tri_index, float* u, float* v);
+
+#endif
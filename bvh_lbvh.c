@@ -0,0 +1,221 @@
+#include "bvh_internal.h"
+#include "parallel.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+// Splitting once per differing Morton bit can chain up to 63 levels over
+// clustered input. Past this depth emit_lbvh only takes median splits, which
+// halve the range each time, so the tree stays under the 64-entry traversal
+// stacks for any primitive count that fits in an int.
+#define LBVH_MAX_BIT_DEPTH 32
+
+typedef struct {
+    uint64_t code;
+    int index;
+} MortonPrim;
+
+static uint64_t expand_bits(uint64_t v, int bits_per_axis) {
+    if (bits_per_axis <= 10) {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x1f00000000ffffULL;
+    v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+    v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v << 2)) & 0x1249249249249249ULL;
+    return v;
+}
+
+typedef struct {
+    const PrimInfo* prims;
+    MortonPrim* morton;
+    AABB centroid_bounds;
+    int bits_per_axis;
+    AABB* partial;
+} MortonTask;
+
+static void centroid_bounds_range(void* arg, int thread, int begin, int end) {
+    MortonTask* task = (MortonTask*)arg;
+    AABB b = aabb_empty();
+    for (int i = begin; i < end; i++) b = aabb_extend(b, task->prims[i].centroid);
+    task->partial[thread] = b;
+}
+
+static void morton_range(void* arg, int thread, int begin, int end) {
+    (void)thread;
+    MortonTask* task = (MortonTask*)arg;
+    float scale = (float)((1u << task->bits_per_axis) - 1);
+    Vec3 lo = task->centroid_bounds.min;
+    Vec3 extent = vec3_sub(task->centroid_bounds.max, lo);
+    Vec3 inv = {extent.x > 0.0f ? scale / extent.x : 0.0f,
+                extent.y > 0.0f ? scale / extent.y : 0.0f,
+                extent.z > 0.0f ? scale / extent.z : 0.0f};
+    for (int i = begin; i < end; i++) {
+        Vec3 c = task->prims[i].centroid;
+        uint64_t x = (uint64_t)fminf(fmaxf((c.x - lo.x) * inv.x, 0.0f), scale);
+        uint64_t y = (uint64_t)fminf(fmaxf((c.y - lo.y) * inv.y, 0.0f), scale);
+        uint64_t z = (uint64_t)fminf(fmaxf((c.z - lo.z) * inv.z, 0.0f), scale);
+        task->morton[i].code = (expand_bits(x, task->bits_per_axis) << 2) |
+                               (expand_bits(y, task->bits_per_axis) << 1) |
+                               expand_bits(z, task->bits_per_axis);
+        task->morton[i].index = i;
+    }
+}
+
+typedef struct {
+    const MortonPrim* in;
+    MortonPrim* out;
+    int shift;
+    int threads;
+    int count;
+    int (*histogram)[RADIX_BUCKETS];
+} RadixTask;
+
+static void radix_count_range(void* arg, int thread, int begin, int end) {
+    RadixTask* task = (RadixTask*)arg;
+    int* h = task->histogram[thread];
+    for (int b = 0; b < RADIX_BUCKETS; b++) h[b] = 0;
+    for (int i = begin; i < end; i++) h[(task->in[i].code >> task->shift) & (RADIX_BUCKETS - 1)]++;
+}
+
+static void radix_scatter_range(void* arg, int thread, int begin, int end) {
+    RadixTask* task = (RadixTask*)arg;
+    int* offset = task->histogram[thread];
+    for (int i = begin; i < end; i++) {
+        int b = (int)((task->in[i].code >> task->shift) & (RADIX_BUCKETS - 1));
+        task->out[offset[b]++] = task->in[i];
+    }
+}
+
+static MortonPrim* radix_sort(MortonPrim* data, MortonPrim* scratch, int count, int total_bits, int threads) {
+    int (*histogram)[RADIX_BUCKETS] = malloc(sizeof(int) * RADIX_BUCKETS * threads);
+    for (int shift = 0; shift < total_bits; shift += RADIX_BITS) {
+        RadixTask task = {data, scratch, shift, threads, count, histogram};
+        parallel_for(count, threads, PARALLEL_BUILD_MIN_PRIMS, radix_count_range, &task);
+
+        int sum = 0;
+        for (int b = 0; b < RADIX_BUCKETS; b++) {
+            for (int t = 0; t < threads; t++) {
+                int n = histogram[t][b];
+                histogram[t][b] = sum;
+                sum += n;
+            }
+        }
+        parallel_for(count, threads, PARALLEL_BUILD_MIN_PRIMS, radix_scatter_range, &task);
+
+        MortonPrim* tmp = data;
+        data = scratch;
+        scratch = tmp;
+    }
+    free(histogram);
+    return data;
+}
+
+typedef struct {
+    BuildContext* ctx;
+    PrimInfo* prims;
+    const MortonPrim* morton;
+    int start, end, bit, depth, threads;
+    BVHBuildNode* result;
+} EmitTask;
+
+static BVHBuildNode* emit_lbvh(BuildContext* ctx, PrimInfo* prims, const MortonPrim* morton,
+                               int start, int end, int bit, int depth, int threads);
+
+static void* emit_subtree(void* arg) {
+    EmitTask* task = (EmitTask*)arg;
+    task->result = emit_lbvh(task->ctx, task->prims, task->morton, task->start, task->end, task->bit, task->depth,
+                             task->threads);
+    return NULL;
+}
+
+static BVHBuildNode* emit_lbvh(BuildContext* ctx, PrimInfo* prims, const MortonPrim* morton,
+                               int start, int end, int bit, int depth, int threads) {
+    BVHBuildNode* node = alloc_node(ctx);
+    int count = end - start;
+    if (count <= ctx->options->max_leaf_prims && count <= BVH_MAX_LEAF_PRIMS) {
+        AABB bounds = aabb_empty();
+        for (int i = start; i < end; i++) bounds = aabb_union(bounds, prims[i].bounds);
+        node->bounds = bounds;
+        return make_leaf(ctx, node, prims, start, end);
+    }
+
+    int split = -1;
+    if (depth >= LBVH_MAX_BIT_DEPTH) bit = -1;
+    for (; bit >= 0; bit--) {
+        uint64_t mask = 1ULL << bit;
+        if ((morton[start].code & mask) == (morton[end - 1].code & mask)) continue;
+        int lo = start, hi = end - 1;
+        while (lo + 1 < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (morton[mid].code & mask) hi = mid;
+            else lo = mid;
+        }
+        split = hi;
+        break;
+    }
+    if (split < 0) split = start + count / 2;
+    node->axis = bit >= 0 ? 2 - bit % 3 : 0;
+
+    int left_threads = threads / 2;
+    pthread_t thread;
+    EmitTask left = {ctx, prims, morton, start, split, bit - 1, depth + 1, left_threads, NULL};
+    if (left_threads >= 1 && split - start >= PARALLEL_BUILD_MIN_PRIMS && end - split >= PARALLEL_BUILD_MIN_PRIMS &&
+        pthread_create(&thread, NULL, emit_subtree, &left) == 0) {
+        node->children[1] = emit_lbvh(ctx, prims, morton, split, end, bit - 1, depth + 1, threads - left_threads);
+        pthread_join(thread, NULL);
+        node->children[0] = left.result;
+    } else {
+        node->children[0] = emit_lbvh(ctx, prims, morton, start, split, bit - 1, depth + 1, threads);
+        node->children[1] = emit_lbvh(ctx, prims, morton, split, end, bit - 1, depth + 1, threads);
+    }
+    node->bounds = aabb_union(node->children[0]->bounds, node->children[1]->bounds);
+    return node;
+}
+
+typedef struct {
+    const PrimInfo* src;
+    PrimInfo* dst;
+    const MortonPrim* morton;
+} ReorderTask;
+
+static void reorder_range(void* arg, int thread, int begin, int end) {
+    (void)thread;
+    ReorderTask* task = (ReorderTask*)arg;
+    for (int i = begin; i < end; i++) task->dst[i] = task->src[task->morton[i].index];
+}
+
+BVHBuildNode* bvh_build_lbvh(BuildContext* ctx, PrimInfo* prims, int count, int threads) {
+    int bits_per_axis = ctx->options->morton_bits > 30 ? 21 : 10;
+    if (threads > count / PARALLEL_BUILD_MIN_PRIMS) threads = count / PARALLEL_BUILD_MIN_PRIMS;
+    if (threads < 1) threads = 1;
+
+    AABB partial[MAX_BUILD_THREADS];
+    MortonPrim* morton = (MortonPrim*)malloc(sizeof(MortonPrim) * count);
+    MortonTask task = {prims, morton, aabb_empty(), bits_per_axis, partial};
+    parallel_for(count, threads, PARALLEL_BUILD_MIN_PRIMS, centroid_bounds_range, &task);
+    for (int t = 0; t < threads; t++) task.centroid_bounds = aabb_union(task.centroid_bounds, partial[t]);
+    parallel_for(count, threads, PARALLEL_BUILD_MIN_PRIMS, morton_range, &task);
+
+    MortonPrim* scratch = (MortonPrim*)malloc(sizeof(MortonPrim) * count);
+    MortonPrim* sorted = radix_sort(morton, scratch, count, 3 * bits_per_axis, threads);
+
+    PrimInfo* ordered = (PrimInfo*)malloc(sizeof(PrimInfo) * count);
+    ReorderTask reorder = {prims, ordered, sorted};
+    parallel_for(count, threads, PARALLEL_BUILD_MIN_PRIMS, reorder_range, &reorder);
+    memcpy(prims, ordered, sizeof(PrimInfo) * count);
+    free(ordered);
+
+    BVHBuildNode* root = emit_lbvh(ctx, prims, sorted, 0, count, 3 * bits_per_axis - 1, 0, threads);
+    free(morton);
+    free(scratch);
+    return root;
+}
@@ -0,0 +1,217 @@
+#include "bvh_internal.h"
+
+#ifdef BVH_X86
+
+#define PACKET_GROUPS (BVH_MAX_PACKET / 4)
+
+typedef struct {
+    __m128 ox, oy, oz;
+    __m128 dx, dy, dz;
+    __m128 ix, iy, iz;
+    __m128 t, u, v;
+    __m128i id;
+} RayGroup;
+
+typedef struct {
+    RayGroup group[PACKET_GROUPS];
+    int group_count;
+    int dir_neg[3];
+    Vec3 origin_min, origin_max;
+    Vec3 inv_min, inv_max;
+} RayPacket;
+
+static bool packet_coherent(const Ray* rays, int count) {
+    int sx = rays[0].direction.x < 0.0f, sy = rays[0].direction.y < 0.0f, sz = rays[0].direction.z < 0.0f;
+    for (int i = 1; i < count; i++) {
+        if ((rays[i].direction.x < 0.0f) != sx || (rays[i].direction.y < 0.0f) != sy || (rays[i].direction.z < 0.0f) != sz) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void packet_init(RayPacket* p, const Ray* rays, int count, float t_max) {
+    _Alignas(16) float lane[9][4];
+    p->group_count = (count + 3) / 4;
+    p->origin_min = p->origin_max = rays[0].origin;
+    Vec3 inv0 = {safe_rcp(rays[0].direction.x), safe_rcp(rays[0].direction.y), safe_rcp(rays[0].direction.z)};
+    p->inv_min = p->inv_max = inv0;
+    p->dir_neg[0] = inv0.x < 0.0f;
+    p->dir_neg[1] = inv0.y < 0.0f;
+    p->dir_neg[2] = inv0.z < 0.0f;
+
+    for (int g = 0; g < p->group_count; g++) {
+        for (int k = 0; k < 4; k++) {
+            int i = (g * 4 + k < count) ? g * 4 + k : count - 1;
+            Ray r = rays[i];
+            Vec3 inv = {safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+            float values[9] = {r.origin.x, r.origin.y, r.origin.z, r.direction.x, r.direction.y, r.direction.z, inv.x, inv.y, inv.z};
+            for (int c = 0; c < 9; c++) lane[c][k] = values[c];
+            p->origin_min = vec3_min(p->origin_min, r.origin);
+            p->origin_max = vec3_max(p->origin_max, r.origin);
+            p->inv_min = vec3_min(p->inv_min, inv);
+            p->inv_max = vec3_max(p->inv_max, inv);
+        }
+        RayGroup* rg = &p->group[g];
+        rg->ox = _mm_load_ps(lane[0]); rg->oy = _mm_load_ps(lane[1]); rg->oz = _mm_load_ps(lane[2]);
+        rg->dx = _mm_load_ps(lane[3]); rg->dy = _mm_load_ps(lane[4]); rg->dz = _mm_load_ps(lane[5]);
+        rg->ix = _mm_load_ps(lane[6]); rg->iy = _mm_load_ps(lane[7]); rg->iz = _mm_load_ps(lane[8]);
+        rg->t = _mm_set1_ps(t_max);
+        rg->u = rg->v = _mm_setzero_ps();
+        rg->id = _mm_set1_epi32(-1);
+    }
+}
+
+static inline void interval_mul(float lo, float hi, float ilo, float ihi, float* out_lo, float* out_hi) {
+    float a = lo * ilo, b = lo * ihi, c = hi * ilo, d = hi * ihi;
+    *out_lo = fminf(fminf(a, b), fminf(c, d));
+    *out_hi = fmaxf(fmaxf(a, b), fmaxf(c, d));
+}
+
+// Interval arithmetic over the packet's origin and reciprocal direction
+// bounds: a conservative test that no ray in the packet can enter the box.
+static bool packet_frustum_misses(const RayPacket* p, const AABB* b, float t_min, float t_max) {
+    float near_lo = t_min, far_hi = t_max;
+    for (int axis = 0; axis < 3; axis++) {
+        float bmin = vec3_axis(p->dir_neg[axis] ? b->max : b->min, axis);
+        float bmax = vec3_axis(p->dir_neg[axis] ? b->min : b->max, axis);
+        float omin = vec3_axis(p->origin_min, axis), omax = vec3_axis(p->origin_max, axis);
+        float ilo = vec3_axis(p->inv_min, axis), ihi = vec3_axis(p->inv_max, axis);
+        float lo, hi;
+        interval_mul(bmin - omax, bmin - omin, ilo, ihi, &lo, &hi);
+        near_lo = fmaxf(near_lo, lo);
+        interval_mul(bmax - omax, bmax - omin, ilo, ihi, &lo, &hi);
+        far_hi = fminf(far_hi, hi);
+    }
+    return near_lo > far_hi;
+}
+
+static inline int group_hits_box(const RayGroup* g, const AABB* b, const int dir_neg[3], __m128 t_min) {
+    __m128 nx = _mm_set1_ps(dir_neg[0] ? b->max.x : b->min.x), fx = _mm_set1_ps(dir_neg[0] ? b->min.x : b->max.x);
+    __m128 ny = _mm_set1_ps(dir_neg[1] ? b->max.y : b->min.y), fy = _mm_set1_ps(dir_neg[1] ? b->min.y : b->max.y);
+    __m128 nz = _mm_set1_ps(dir_neg[2] ? b->max.z : b->min.z), fz = _mm_set1_ps(dir_neg[2] ? b->min.z : b->max.z);
+    __m128 t0 = _mm_max_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(nx, g->ox), g->ix), _mm_mul_ps(_mm_sub_ps(ny, g->oy), g->iy)),
+                           _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nz, g->oz), g->iz), t_min));
+    __m128 t1 = _mm_min_ps(_mm_min_ps(_mm_mul_ps(_mm_sub_ps(fx, g->ox), g->ix), _mm_mul_ps(_mm_sub_ps(fy, g->oy), g->iy)),
+                           _mm_min_ps(_mm_mul_ps(_mm_sub_ps(fz, g->oz), g->iz), g->t));
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+static inline void group_intersect_triangle(RayGroup* g, const TriangleBlock* b, int lane, __m128 t_min) {
+    __m128 e1x = _mm_set1_ps(b->e1[0][lane]), e1y = _mm_set1_ps(b->e1[1][lane]), e1z = _mm_set1_ps(b->e1[2][lane]);
+    __m128 e2x = _mm_set1_ps(b->e2[0][lane]), e2y = _mm_set1_ps(b->e2[1][lane]), e2z = _mm_set1_ps(b->e2[2][lane]);
+
+    __m128 hx = _mm_sub_ps(_mm_mul_ps(g->dy, e2z), _mm_mul_ps(g->dz, e2y));
+    __m128 hy = _mm_sub_ps(_mm_mul_ps(g->dz, e2x), _mm_mul_ps(g->dx, e2z));
+    __m128 hz = _mm_sub_ps(_mm_mul_ps(g->dx, e2y), _mm_mul_ps(g->dy, e2x));
+    __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+    __m128 abs_a = _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+    __m128 mask = _mm_cmpge_ps(abs_a, _mm_set1_ps(EPSILON));
+    if (!_mm_movemask_ps(mask)) return;
+
+    __m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+    __m128 sx = _mm_sub_ps(g->ox, _mm_set1_ps(b->v0[0][lane]));
+    __m128 sy = _mm_sub_ps(g->oy, _mm_set1_ps(b->v0[1][lane]));
+    __m128 sz = _mm_sub_ps(g->oz, _mm_set1_ps(b->v0[2][lane]));
+    __m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), _mm_cmple_ps(u, _mm_set1_ps(1.0f))));
+    if (!_mm_movemask_ps(mask)) return;
+
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    __m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(g->dx, qx), _mm_mul_ps(g->dy, qy)), _mm_mul_ps(g->dz, qz)));
+    __m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f))));
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, t_min), _mm_cmplt_ps(t, g->t)));
+    if (!_mm_movemask_ps(mask)) return;
+
+    g->t = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, g->t));
+    g->u = _mm_or_ps(_mm_and_ps(mask, u), _mm_andnot_ps(mask, g->u));
+    g->v = _mm_or_ps(_mm_and_ps(mask, v), _mm_andnot_ps(mask, g->v));
+    __m128i imask = _mm_castps_si128(mask);
+    g->id = _mm_or_si128(_mm_and_si128(imask, _mm_set1_epi32(b->prim[lane])), _mm_andnot_si128(imask, g->id));
+}
+
+static float packet_max_t(const RayPacket* p) {
+    __m128 m = p->group[0].t;
+    for (int g = 1; g < p->group_count; g++) m = _mm_max_ps(m, p->group[g].t);
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(m);
+}
+
+static void traverse_packet(const BVH* bvh, RayPacket* p, float t_min) {
+    __m128 tmin4 = _mm_set1_ps(t_min);
+    int stack[64];
+    int stack_ptr = 0;
+    int current = 0;
+
+    while (true) {
+        const BVHNode* node = &bvh->nodes[current];
+        int masks[PACKET_GROUPS] = {0};
+        bool visit = false;
+        if (!packet_frustum_misses(p, &node->bounds, t_min, packet_max_t(p))) {
+            for (int g = 0; g < p->group_count; g++) {
+                masks[g] = group_hits_box(&p->group[g], &node->bounds, p->dir_neg, tmin4);
+                if (masks[g]) {
+                    visit = true;
+                    if (node->prim_count == 0) break;
+                }
+            }
+        }
+
+        if (visit && node->prim_count > 0) {
+            const TriangleBlock* blocks = &bvh->tri_blocks[node->prim_offset >> 2];
+            for (int i = 0; i < node->prim_count; i++) {
+                for (int g = 0; g < p->group_count; g++) {
+                    if (masks[g]) group_intersect_triangle(&p->group[g], &blocks[i >> 2], i & 3, tmin4);
+                }
+            }
+        } else if (visit) {
+            if (p->dir_neg[node->axis]) {
+                stack[stack_ptr++] = current + 1;
+                current = node->second_child_offset;
+            } else {
+                stack[stack_ptr++] = node->second_child_offset;
+                current = current + 1;
+            }
+            continue;
+        }
+        if (stack_ptr == 0) break;
+        current = stack[--stack_ptr];
+    }
+}
+
+#endif
+
+void bvh_intersect_packet(const BVH* bvh, const Ray* rays, int count, float t_min, float t_max,
+                          float* t, int* tri_index, float* u, float* v) {
+#ifdef BVH_X86
+    if (bvh->nodes && count >= 4 && count <= BVH_MAX_PACKET && packet_coherent(rays, count)) {
+        RayPacket p;
+        packet_init(&p, rays, count, t_max);
+        traverse_packet(bvh, &p, t_min);
+        _Alignas(16) float lt[4], lu[4], lv[4];
+        _Alignas(16) int lid[4];
+        for (int g = 0; g < p.group_count; g++) {
+            _mm_store_ps(lt, p.group[g].t);
+            _mm_store_ps(lu, p.group[g].u);
+            _mm_store_ps(lv, p.group[g].v);
+            _mm_store_si128((__m128i*)lid, p.group[g].id);
+            for (int k = 0; k < 4 && g * 4 + k < count; k++) {
+                int i = g * 4 + k;
+                tri_index[i] = lid[k];
+                t[i] = lt[k];
+                u[i] = lu[k];
+                v[i] = lv[k];
+                if (lid[k] >= 0) resolve_quad_hit(bvh, &tri_index[i], &u[i], &v[i]);
+            }
+        }
+        return;
+    }
+#endif
+    for (int i = 0; i < count; i++) {
+        if (!bvh_intersect(bvh, rays[i], t_min, t_max, &t[i], &tri_index[i], &u[i], &v[i])) tri_index[i] = -1;
+    }
+}
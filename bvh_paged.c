@@ -0,0 +1,595 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bvh_paged.h"
+#include "bvh_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define BVH_PAGED_MAGIC "PTBVHPG\0"
+#define BVH_PAGED_VERSION 1
+#define BVH_PAGED_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint32_t block_size;
+    int32_t prim_count;
+    uint64_t hash;
+    int32_t top_node_count;
+    int32_t chunk_count;
+    uint64_t max_chunk_bytes;
+    uint64_t top_offset;
+    uint64_t chunks_offset;
+    uint64_t file_size;
+} PagedHeader;
+
+typedef struct {
+    int chunk;
+    int pins;
+    bool loading;
+    uint64_t last_use;
+    void* data;
+} PagedSlot;
+
+// Slots are pinned while a thread traverses their chunk. A chunk being read
+// stays marked as loading so that other threads wait for it instead of
+// issuing the same read; the lock is not held during I/O.
+struct PagedCache {
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    PagedSlot* slots;
+    int slot_count;
+    int* chunk_slot;
+    uint64_t clock;
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t loads;
+    uint64_t bytes_read;
+    uint64_t queued_rays;
+};
+
+typedef struct {
+    int chunk;
+    int ray;
+    float tnear;
+} PagedEntry;
+
+typedef struct {
+    const BVH* bvh;
+    FILE* f;
+    size_t chunk_bytes;
+    BVHNode* top;
+    int top_count;
+    PagedChunk* chunks;
+    int chunk_count;
+    uint64_t offset;
+    size_t max_chunk_bytes;
+    bool ok;
+} PagedWriter;
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + BVH_PAGED_ALIGN - 1) / BVH_PAGED_ALIGN * BVH_PAGED_ALIGN;
+}
+
+static size_t chunk_size(int node_count, int block_count) {
+    return align_offset(sizeof(BVHNode) * node_count) + sizeof(TriangleBlock) * block_count;
+}
+
+static bool write_section(FILE* f, uint64_t offset, const void* data, size_t size) {
+    static const char zeros[BVH_PAGED_ALIGN] = {0};
+    long pos = ftell(f);
+    if (pos < 0 || (uint64_t)pos > offset) return false;
+    if (fwrite(zeros, 1, offset - (uint64_t)pos, f) != offset - (uint64_t)pos) return false;
+    return size == 0 || fwrite(data, 1, size, f) == size;
+}
+
+// In the DFS layout a subtree is the node range [node, end), ending with its
+// rightmost leaf, and its leaves own a contiguous range of blocks.
+static int subtree_end(const BVHNode* nodes, int node) {
+    while (nodes[node].prim_count == 0) node = nodes[node].second_child_offset;
+    return node + 1;
+}
+
+static void subtree_blocks(const BVHNode* nodes, int node, int end, int* first, int* last) {
+    while (nodes[node].prim_count == 0) node++;
+    const BVHNode* leaf = &nodes[end - 1];
+    *first = nodes[node].prim_offset >> 2;
+    *last = (leaf->prim_offset + leaf->prim_count + 3) >> 2;
+}
+
+static void write_chunk(PagedWriter* w, int node, int end) {
+    const BVHNode* nodes = w->bvh->nodes;
+    int first, last;
+    subtree_blocks(nodes, node, end, &first, &last);
+    int n = end - node;
+    BVHNode* local = (BVHNode*)malloc(sizeof(BVHNode) * n);
+    for (int i = 0; i < n; i++) {
+        local[i] = nodes[node + i];
+        if (local[i].prim_count > 0) local[i].prim_offset -= first * 4;
+        else local[i].second_child_offset -= node;
+    }
+    uint64_t start = align_offset(w->offset);
+    w->ok = w->ok && write_section(w->f, start, local, sizeof(BVHNode) * n) &&
+            write_section(w->f, start + align_offset(sizeof(BVHNode) * n), &w->bvh->tri_blocks[first],
+                          sizeof(TriangleBlock) * (last - first));
+    free(local);
+    size_t size = chunk_size(n, last - first);
+    if (size > w->max_chunk_bytes) w->max_chunk_bytes = size;
+    w->chunks[w->chunk_count++] = (PagedChunk){start, n, last - first};
+    w->offset = start + size;
+}
+
+// Keeps a node in the resident top while its subtree is larger than a
+// chunk; otherwise the whole subtree becomes one chunk, referenced from a
+// top-level leaf.
+static int cut_subtree(PagedWriter* w, int node) {
+    const BVHNode* nodes = w->bvh->nodes;
+    int top = w->top_count++;
+    int end = subtree_end(nodes, node);
+    int first, last;
+    subtree_blocks(nodes, node, end, &first, &last);
+    w->top[top] = nodes[node];
+    if (nodes[node].prim_count > 0 || chunk_size(end - node, last - first) <= w->chunk_bytes) {
+        w->top[top].prim_offset = w->chunk_count;
+        w->top[top].prim_count = 1;
+        write_chunk(w, node, end);
+    } else {
+        cut_subtree(w, node + 1);
+        w->top[top].second_child_offset = cut_subtree(w, nodes[node].second_child_offset);
+    }
+    return top;
+}
+
+bool bvh_paged_write(const BVH* bvh, const char* path, size_t chunk_bytes) {
+    if (!bvh->nodes || !bvh->tri_blocks) return false;
+    // Written under a temporary name and renamed so that a concurrent
+    // bvh_paged_open never reads a partially written file.
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%ld", path, (long)getpid());
+    FILE* f = fopen(tmp_path, "wb");
+    if (!f) return false;
+    PagedWriter w = {
+        .bvh = bvh,
+        .f = f,
+        .chunk_bytes = chunk_bytes,
+        .top = (BVHNode*)malloc(sizeof(BVHNode) * bvh->node_count),
+        .chunks = (PagedChunk*)malloc(sizeof(PagedChunk) * bvh->node_count),
+        .offset = align_offset(sizeof(PagedHeader)),
+        .ok = true
+    };
+    w.ok = write_section(f, 0, NULL, 0);
+    cut_subtree(&w, 0);
+
+    PagedHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BVH_PAGED_MAGIC, 8);
+    h.version = BVH_PAGED_VERSION;
+    h.node_size = sizeof(BVHNode);
+    h.block_size = sizeof(TriangleBlock);
+    h.prim_count = bvh->tri_count;
+    h.hash = bvh_content_hash(&bvh->mesh, &bvh->options);
+    h.top_node_count = w.top_count;
+    h.chunk_count = w.chunk_count;
+    h.max_chunk_bytes = w.max_chunk_bytes;
+    h.top_offset = align_offset(w.offset);
+    h.chunks_offset = align_offset(h.top_offset + sizeof(BVHNode) * (uint64_t)w.top_count);
+    h.file_size = h.chunks_offset + sizeof(PagedChunk) * (uint64_t)w.chunk_count;
+    bool ok = w.ok && write_section(f, h.top_offset, w.top, sizeof(BVHNode) * w.top_count) &&
+              write_section(f, h.chunks_offset, w.chunks, sizeof(PagedChunk) * w.chunk_count) &&
+              fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+    free(w.top);
+    free(w.chunks);
+    if (ok) ok = rename(tmp_path, path) == 0;
+    if (!ok) remove(tmp_path);
+    return ok;
+}
+
+static bool read_at(int fd, void* data, size_t size, uint64_t offset) {
+    char* p = (char*)data;
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, (off_t)offset);
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+static bool header_valid(const PagedHeader* h, uint64_t size, uint64_t hash, int prim_count) {
+    if (memcmp(h->magic, BVH_PAGED_MAGIC, 8) != 0 || h->version != BVH_PAGED_VERSION) return false;
+    if (h->node_size != sizeof(BVHNode) || h->block_size != sizeof(TriangleBlock)) return false;
+    if (h->hash != hash || h->prim_count != prim_count || h->file_size != size) return false;
+    if (h->top_node_count <= 0 || h->chunk_count <= 0 || h->max_chunk_bytes == 0) return false;
+    return h->top_offset + sizeof(BVHNode) * (uint64_t)h->top_node_count <= h->chunks_offset &&
+           h->chunks_offset + sizeof(PagedChunk) * (uint64_t)h->chunk_count <= size;
+}
+
+bool bvh_paged_open(PagedBVH* paged, const char* path, const TriangleMesh* mesh, const BVHBuildOptions* options, size_t cache_bytes) {
+    memset(paged, 0, sizeof(PagedBVH));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    PagedHeader h;
+    BVHBuildOptions opt = options ? *options : bvh_default_options();
+    if (fstat(fd, &st) != 0 || !read_at(fd, &h, sizeof(h), 0) ||
+        !header_valid(&h, (uint64_t)st.st_size, bvh_content_hash(mesh, &opt), mesh_prim_count(mesh))) {
+        close(fd);
+        return false;
+    }
+    paged->top_nodes = (BVHNode*)malloc(sizeof(BVHNode) * h.top_node_count);
+    paged->chunks = (PagedChunk*)malloc(sizeof(PagedChunk) * h.chunk_count);
+    bool ok = read_at(fd, paged->top_nodes, sizeof(BVHNode) * h.top_node_count, h.top_offset) &&
+              read_at(fd, paged->chunks, sizeof(PagedChunk) * h.chunk_count, h.chunks_offset);
+    for (int i = 0; ok && i < h.chunk_count; i++) {
+        const PagedChunk* c = &paged->chunks[i];
+        ok = c->node_count > 0 && chunk_size(c->node_count, c->block_count) <= h.max_chunk_bytes &&
+             c->offset + chunk_size(c->node_count, c->block_count) <= h.top_offset;
+    }
+    if (!ok) {
+        free(paged->top_nodes);
+        free(paged->chunks);
+        memset(paged, 0, sizeof(PagedBVH));
+        close(fd);
+        return false;
+    }
+    paged->top_node_count = h.top_node_count;
+    paged->chunk_count = h.chunk_count;
+    paged->max_chunk_bytes = h.max_chunk_bytes;
+    paged->mesh = *mesh;
+
+    PagedCache* cache = (PagedCache*)calloc(1, sizeof(PagedCache));
+    cache->fd = fd;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->changed, NULL);
+    cache->slot_count = (int)(cache_bytes / paged->max_chunk_bytes);
+    if (cache->slot_count < 1) cache->slot_count = 1;
+    if (cache->slot_count > paged->chunk_count) cache->slot_count = paged->chunk_count;
+    cache->slots = (PagedSlot*)calloc(cache->slot_count, sizeof(PagedSlot));
+    for (int i = 0; i < cache->slot_count; i++) cache->slots[i].chunk = -1;
+    cache->chunk_slot = (int*)malloc(sizeof(int) * paged->chunk_count);
+    for (int i = 0; i < paged->chunk_count; i++) cache->chunk_slot[i] = -1;
+    paged->cache = cache;
+    return true;
+}
+
+// Returns the pinned slot holding the chunk, loading it into the least
+// recently used free slot on a miss, or -1 if the read failed.
+static int acquire_chunk(const PagedBVH* paged, int chunk) {
+    PagedCache* cache = paged->cache;
+    pthread_mutex_lock(&cache->lock);
+    cache->lookups++;
+    while (true) {
+        int s = cache->chunk_slot[chunk];
+        if (s >= 0) {
+            if (cache->slots[s].loading) {
+                pthread_cond_wait(&cache->changed, &cache->lock);
+                continue;
+            }
+            cache->slots[s].pins++;
+            cache->slots[s].last_use = ++cache->clock;
+            cache->hits++;
+            pthread_mutex_unlock(&cache->lock);
+            return s;
+        }
+        int victim = -1;
+        for (int i = 0; i < cache->slot_count; i++) {
+            const PagedSlot* slot = &cache->slots[i];
+            if (slot->pins == 0 && !slot->loading && (victim < 0 || slot->last_use < cache->slots[victim].last_use)) victim = i;
+        }
+        if (victim < 0) {
+            pthread_cond_wait(&cache->changed, &cache->lock);
+            continue;
+        }
+        PagedSlot* slot = &cache->slots[victim];
+        if (slot->chunk >= 0) cache->chunk_slot[slot->chunk] = -1;
+        if (!slot->data) slot->data = aligned_alloc(BVH_PAGED_ALIGN, align_offset(paged->max_chunk_bytes));
+        slot->chunk = chunk;
+        slot->loading = true;
+        slot->pins = 1;
+        slot->last_use = ++cache->clock;
+        cache->chunk_slot[chunk] = victim;
+        pthread_mutex_unlock(&cache->lock);
+
+        const PagedChunk* c = &paged->chunks[chunk];
+        size_t size = chunk_size(c->node_count, c->block_count);
+        bool ok = read_at(cache->fd, slot->data, size, c->offset);
+
+        pthread_mutex_lock(&cache->lock);
+        slot->loading = false;
+        cache->loads++;
+        cache->bytes_read += size;
+        if (!ok) {
+            cache->chunk_slot[chunk] = -1;
+            slot->chunk = -1;
+            slot->pins = 0;
+            victim = -1;
+        }
+        pthread_cond_broadcast(&cache->changed);
+        pthread_mutex_unlock(&cache->lock);
+        return victim;
+    }
+}
+
+static void release_chunk(const PagedBVH* paged, int s) {
+    PagedCache* cache = paged->cache;
+    pthread_mutex_lock(&cache->lock);
+    if (--cache->slots[s].pins == 0) pthread_cond_broadcast(&cache->changed);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// A resident chunk is a small binary BVH over its own nodes and blocks.
+static BVH chunk_view(const PagedBVH* paged, int chunk, int s) {
+    const PagedChunk* c = &paged->chunks[chunk];
+    char* data = (char*)paged->cache->slots[s].data;
+    BVH view;
+    memset(&view, 0, sizeof(BVH));
+    view.nodes = (BVHNode*)data;
+    view.node_count = c->node_count;
+    view.tri_blocks = (TriangleBlock*)(data + align_offset(sizeof(BVHNode) * c->node_count));
+    view.tri_block_count = c->block_count;
+    view.mesh = paged->mesh;
+    view.width = 2;
+    return view;
+}
+
+bool bvh_paged_intersect(const PagedBVH* paged, Ray r, float t_min, float t_max, float* t, int* tri_index, float* u, float* v) {
+    if (!paged->top_nodes) return false;
+    bool hit = false;
+    float closest_t = t_max;
+    Vec3 inv_dir = {safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+    int dir_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+    int stack[64];
+    int stack_ptr = 0;
+    int current = 0;
+
+    while (true) {
+        const BVHNode* node = &paged->top_nodes[current];
+        if (intersect_aabb(&node->bounds, r.origin, inv_dir, dir_neg, t_min, closest_t)) {
+            if (node->prim_count > 0) {
+                int s = acquire_chunk(paged, node->prim_offset);
+                if (s >= 0) {
+                    BVH view = chunk_view(paged, node->prim_offset, s);
+                    if (bvh_intersect(&view, r, t_min, closest_t, t, tri_index, u, v)) {
+                        closest_t = *t;
+                        hit = true;
+                    }
+                    release_chunk(paged, s);
+                }
+                if (stack_ptr == 0) break;
+                current = stack[--stack_ptr];
+            } else if (dir_neg[node->axis]) {
+                stack[stack_ptr++] = current + 1;
+                current = node->second_child_offset;
+            } else {
+                stack[stack_ptr++] = node->second_child_offset;
+                current = current + 1;
+            }
+        } else {
+            if (stack_ptr == 0) break;
+            current = stack[--stack_ptr];
+        }
+    }
+    return hit;
+}
+
+bool bvh_paged_occluded(const PagedBVH* paged, Ray r, float t_min, float t_max) {
+    if (!paged->top_nodes) return false;
+    Vec3 inv_dir = {safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+    int dir_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+    int stack[64];
+    int stack_ptr = 0;
+    int current = 0;
+
+    while (true) {
+        const BVHNode* node = &paged->top_nodes[current];
+        if (intersect_aabb(&node->bounds, r.origin, inv_dir, dir_neg, t_min, t_max)) {
+            if (node->prim_count > 0) {
+                int s = acquire_chunk(paged, node->prim_offset);
+                if (s >= 0) {
+                    BVH view = chunk_view(paged, node->prim_offset, s);
+                    bool occluded = bvh_occluded(&view, r, t_min, t_max);
+                    release_chunk(paged, s);
+                    if (occluded) return true;
+                }
+                if (stack_ptr == 0) break;
+                current = stack[--stack_ptr];
+            } else {
+                stack[stack_ptr++] = node->second_child_offset;
+                current = current + 1;
+            }
+        } else {
+            if (stack_ptr == 0) break;
+            current = stack[--stack_ptr];
+        }
+    }
+    return false;
+}
+
+static float aabb_entry(const AABB* bounds, Vec3 origin, Vec3 inv_dir, const int dir_neg[3], float t_min, float t_max) {
+    const Vec3* b = (const Vec3*)bounds;
+    float t0 = fmaxf(fmaxf((b[dir_neg[0]].x - origin.x) * inv_dir.x, (b[dir_neg[1]].y - origin.y) * inv_dir.y),
+                     fmaxf((b[dir_neg[2]].z - origin.z) * inv_dir.z, t_min));
+    float t1 = fminf(fminf((b[1 - dir_neg[0]].x - origin.x) * inv_dir.x, (b[1 - dir_neg[1]].y - origin.y) * inv_dir.y),
+                     fminf((b[1 - dir_neg[2]].z - origin.z) * inv_dir.z, t_max));
+    return t0 <= t1 ? t0 : MAX_FLOAT;
+}
+
+static void push_entry(PagedEntry** entries, int* count, int* capacity, PagedEntry e) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 64;
+        *entries = (PagedEntry*)realloc(*entries, sizeof(PagedEntry) * *capacity);
+    }
+    (*entries)[(*count)++] = e;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const PagedEntry* x = (const PagedEntry*)a;
+    const PagedEntry* y = (const PagedEntry*)b;
+    if (x->chunk != y->chunk) return x->chunk - y->chunk;
+    return (x->tnear > y->tnear) - (x->tnear < y->tnear);
+}
+
+// Traverses the resident top for every ray and queues a (chunk, ray) entry
+// for every chunk the ray enters before its own t_max, sorted by chunk and
+// then by entry distance.
+static PagedEntry* queue_chunks(const PagedBVH* paged, const Ray* rays, int count, float t_min, const float* t_max, int* entry_count) {
+    PagedEntry* entries = NULL;
+    int capacity = 0;
+    *entry_count = 0;
+    for (int i = 0; i < count; i++) {
+        Ray r = rays[i];
+        Vec3 inv_dir = {safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+        int dir_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+        int stack[64];
+        int stack_ptr = 0;
+        int current = 0;
+        while (true) {
+            const BVHNode* node = &paged->top_nodes[current];
+            float tnear = aabb_entry(&node->bounds, r.origin, inv_dir, dir_neg, t_min, t_max[i]);
+            if (tnear < MAX_FLOAT && node->prim_count == 0) {
+                stack[stack_ptr++] = node->second_child_offset;
+                current = current + 1;
+                continue;
+            }
+            if (tnear < MAX_FLOAT) push_entry(&entries, entry_count, &capacity, (PagedEntry){node->prim_offset, i, tnear});
+            if (stack_ptr == 0) break;
+            current = stack[--stack_ptr];
+        }
+    }
+    qsort(entries, *entry_count, sizeof(PagedEntry), compare_entries);
+    return entries;
+}
+
+// Splits the sorted entries into one run per chunk and orders the runs with
+// the resident chunks first, so that they tighten hit distances or resolve
+// occlusion before any missing chunk is read.
+static int* order_runs(const PagedBVH* paged, const PagedEntry* entries, int entry_count, int** runs_out, int* run_count_out) {
+    int* runs = (int*)malloc(sizeof(int) * (entry_count + 1));
+    int run_count = 0, ordered = 0;
+    PagedCache* cache = paged->cache;
+    pthread_mutex_lock(&cache->lock);
+    for (int i = 0; i < entry_count; i++) {
+        if (i > 0 && entries[i].chunk == entries[i - 1].chunk) continue;
+        runs[run_count++] = i;
+    }
+    runs[run_count] = entry_count;
+    int* order = (int*)malloc(sizeof(int) * (run_count > 0 ? run_count : 1));
+    for (int pass = 0; pass < 2; pass++) {
+        for (int k = 0; k < run_count; k++) {
+            bool resident = cache->chunk_slot[entries[runs[k]].chunk] >= 0;
+            if (resident != (pass == 0)) continue;
+            if (!resident) cache->queued_rays += (uint64_t)(runs[k + 1] - runs[k]);
+            order[ordered++] = k;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    *runs_out = runs;
+    *run_count_out = run_count;
+    return order;
+}
+
+// Visits each chunk once for all of its queued rays; a missing chunk is
+// loaded once and skipped when no queued ray can still find a closer hit.
+void bvh_paged_intersect_batch(const PagedBVH* paged, const Ray* rays, int count, float t_min, float t_max,
+                               float* t, int* tri_index, float* u, float* v) {
+    for (int i = 0; i < count; i++) {
+        t[i] = t_max;
+        tri_index[i] = -1;
+    }
+    if (!paged->top_nodes || count <= 0) return;
+    int entry_count, run_count;
+    int* runs;
+    PagedEntry* entries = queue_chunks(paged, rays, count, t_min, t, &entry_count);
+    int* order = order_runs(paged, entries, entry_count, &runs, &run_count);
+
+    for (int o = 0; o < run_count; o++) {
+        int k = order[o];
+        int chunk = entries[runs[k]].chunk;
+        bool needed = false;
+        for (int i = runs[k]; i < runs[k + 1] && !needed; i++) needed = entries[i].tnear < t[entries[i].ray];
+        if (!needed) continue;
+        int s = acquire_chunk(paged, chunk);
+        if (s < 0) continue;
+        BVH view = chunk_view(paged, chunk, s);
+        for (int i = runs[k]; i < runs[k + 1]; i++) {
+            int ray = entries[i].ray;
+            if (entries[i].tnear >= t[ray]) continue;
+            float ht, hu, hv;
+            int id;
+            if (bvh_intersect(&view, rays[ray], t_min, t[ray], &ht, &id, &hu, &hv)) {
+                t[ray] = ht;
+                tri_index[ray] = id;
+                u[ray] = hu;
+                v[ray] = hv;
+            }
+        }
+        release_chunk(paged, s);
+    }
+    free(order);
+    free(runs);
+    free(entries);
+}
+
+// Shadow rays with per-ray limits; a chunk is skipped once every ray queued
+// on it is already known to be occluded.
+void bvh_paged_occluded_batch(const PagedBVH* paged, const Ray* rays, int count, float t_min, const float* t_max, bool* occluded) {
+    for (int i = 0; i < count; i++) occluded[i] = false;
+    if (!paged->top_nodes || count <= 0) return;
+    int entry_count, run_count;
+    int* runs;
+    PagedEntry* entries = queue_chunks(paged, rays, count, t_min, t_max, &entry_count);
+    int* order = order_runs(paged, entries, entry_count, &runs, &run_count);
+
+    for (int o = 0; o < run_count; o++) {
+        int k = order[o];
+        int chunk = entries[runs[k]].chunk;
+        bool needed = false;
+        for (int i = runs[k]; i < runs[k + 1] && !needed; i++) needed = !occluded[entries[i].ray];
+        if (!needed) continue;
+        int s = acquire_chunk(paged, chunk);
+        if (s < 0) continue;
+        BVH view = chunk_view(paged, chunk, s);
+        for (int i = runs[k]; i < runs[k + 1]; i++) {
+            int ray = entries[i].ray;
+            if (!occluded[ray]) occluded[ray] = bvh_occluded(&view, rays[ray], t_min, t_max[ray]);
+        }
+        release_chunk(paged, s);
+    }
+    free(order);
+    free(runs);
+    free(entries);
+}
+
+void bvh_paged_print_stats(const PagedBVH* paged) {
+    const PagedCache* cache = paged->cache;
+    if (!cache) return;
+    printf("Paged BVH: %d chunks of up to %zu KB, %zu KB resident top, %d cache slots (%zu KB)\n",
+           paged->chunk_count, paged->max_chunk_bytes / 1024, sizeof(BVHNode) * paged->top_node_count / 1024,
+           cache->slot_count, cache->slot_count * paged->max_chunk_bytes / 1024);
+    printf("Paged BVH cache: %llu lookups, %.2f%% hit rate, %llu loads, %.1f MB read, %llu batched rays queued on misses\n",
+           (unsigned long long)cache->lookups, cache->lookups ? 100.0 * cache->hits / cache->lookups : 0.0,
+           (unsigned long long)cache->loads, cache->bytes_read / (1024.0 * 1024.0), (unsigned long long)cache->queued_rays);
+}
+
+void bvh_paged_close(PagedBVH* paged) {
+    PagedCache* cache = paged->cache;
+    if (cache) {
+        for (int i = 0; i < cache->slot_count; i++) free(cache->slots[i].data);
+        free(cache->slots);
+        free(cache->chunk_slot);
+        pthread_mutex_destroy(&cache->lock);
+        pthread_cond_destroy(&cache->changed);
+        close(cache->fd);
+        free(cache);
+    }
+    free(paged->top_nodes);
+    free(paged->chunks);
+    memset(paged, 0, sizeof(PagedBVH));
+}
@@ -0,0 +1,40 @@
+#ifndef BVH_PAGED_H
+#define BVH_PAGED_H
+
+#include "bvh.h"
+
+#define BVH_PAGED_CHUNK_BYTES (128 * 1024)
+
+typedef struct PagedCache PagedCache;
+
+typedef struct {
+    uint64_t offset;
+    int32_t node_count;
+    int32_t block_count;
+} PagedChunk;
+
+// Out-of-core BVH: the top of the tree stays resident, and every subtree
+// below the cut is a chunk of binary nodes plus its leaf TriangleBlocks,
+// read on demand from the paged file into a bounded LRU cache. Top-level
+// leaves reference chunks through prim_offset.
+typedef struct {
+    BVHNode* top_nodes;
+    int top_node_count;
+    PagedChunk* chunks;
+    int chunk_count;
+    size_t max_chunk_bytes;
+    TriangleMesh mesh;
+    PagedCache* cache;
+} PagedBVH;
+
+bool bvh_paged_write(const BVH* bvh, const char* path, size_t chunk_bytes);
+bool bvh_paged_open(PagedBVH* paged, const char* path, const TriangleMesh* mesh, const BVHBuildOptions* options, size_t cache_bytes);
+bool bvh_paged_intersect(const PagedBVH* paged, Ray r, float t_min, float t_max, float* t, int* tri_index, float* u, float* v);
+bool bvh_paged_occluded(const PagedBVH* paged, Ray r, float t_min, float t_max);
+void bvh_paged_intersect_batch(const PagedBVH* paged, const Ray* rays, int count, float t_min, float t_max,
+                               float* t, int* tri_index, float* u, float* v);
+void bvh_paged_occluded_batch(const PagedBVH* paged, const Ray* rays, int count, float t_min, const float* t_max, bool* occluded);
+void bvh_paged_print_stats(const PagedBVH* paged);
+void bvh_paged_close(PagedBVH* paged);
+
+#endif
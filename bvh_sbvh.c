@@ -0,0 +1,259 @@
+#include "bvh_internal.h"
+#include <stdlib.h>
+
+typedef struct {
+    AABB bounds;
+    int entries;
+    int exits;
+} SpatialBin;
+
+typedef struct {
+    int axis;
+    float pos;
+    float cost;
+    AABB left, right;
+    int left_count, right_count;
+} SpatialSplit;
+
+typedef struct {
+    BuildContext* ctx;
+    int max_refs;
+    int ref_count;
+    float root_area;
+    int bins;
+} SBVHBuilder;
+
+static void vec3_set_axis(Vec3* v, int axis, float value) {
+    if (axis == 0) v->x = value;
+    else if (axis == 1) v->y = value;
+    else v->z = value;
+}
+
+static AABB slab_bounds(int axis, float lo, float hi) {
+    AABB slab = {{-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT}, {MAX_FLOAT, MAX_FLOAT, MAX_FLOAT}};
+    vec3_set_axis(&slab.min, axis, lo);
+    vec3_set_axis(&slab.max, axis, hi);
+    return slab;
+}
+
+static bool aabb_valid(AABB b) {
+    return b.min.x <= b.max.x && b.min.y <= b.max.y && b.min.z <= b.max.z;
+}
+
+// Quads also clip their shared diagonal, so that the result bounds both
+// triangle halves even when the quad is not planar.
+static AABB clip_prim(const TriangleMesh* mesh, int prim, AABB ref_bounds, int axis, float lo, float hi) {
+    static const int quad_edges[5][2] = {{0, 1}, {1, 2}, {2, 3}, {3, 0}, {0, 2}};
+    static const int tri_edges[3][2] = {{0, 1}, {1, 2}, {2, 0}};
+    Vec3 v[4];
+    int n = mesh_prim_vertices(mesh, prim, v);
+    const int (*edges)[2] = n == 4 ? quad_edges : tri_edges;
+    int edge_count = n == 4 ? 5 : 3;
+    AABB b = aabb_empty();
+    for (int i = 0; i < edge_count; i++) {
+        Vec3 a = v[edges[i][0]], c = v[edges[i][1]];
+        float pa = vec3_axis(a, axis), pc = vec3_axis(c, axis);
+        if (pa >= lo && pa <= hi) b = aabb_extend(b, a);
+        float planes[2] = {lo, hi};
+        for (int k = 0; k < 2; k++) {
+            float p = planes[k];
+            if ((pa < p && pc > p) || (pa > p && pc < p)) {
+                float t = (p - pa) / (pc - pa);
+                Vec3 x = vec3_add(a, vec3_scale(vec3_sub(c, a), t));
+                vec3_set_axis(&x, axis, p);
+                b = aabb_extend(b, x);
+            }
+        }
+    }
+    return aabb_intersect(aabb_intersect(b, ref_bounds), slab_bounds(axis, lo, hi));
+}
+
+static PrimInfo make_ref(int index, AABB bounds) {
+    return (PrimInfo){index, bounds, vec3_scale(vec3_add(bounds.min, bounds.max), 0.5f)};
+}
+
+static SpatialSplit find_spatial_split(SBVHBuilder* b, const PrimInfo* refs, int n, AABB bounds) {
+    const BVHBuildOptions* opt = b->ctx->options;
+    float inv_area = 1.0f / fmaxf(aabb_surface_area(bounds), 1e-12f);
+    SpatialSplit best = {-1, 0.0f, MAX_FLOAT, aabb_empty(), aabb_empty(), 0, 0};
+    int bins = b->bins;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = vec3_axis(bounds.min, axis);
+        float extent = vec3_axis(bounds.max, axis) - lo;
+        if (extent <= 0.0f) continue;
+        float width = extent / bins;
+        float inv_width = 1.0f / width;
+
+        SpatialBin bin[MAX_SAH_BINS];
+        for (int k = 0; k < bins; k++) bin[k] = (SpatialBin){aabb_empty(), 0, 0};
+
+        for (int i = 0; i < n; i++) {
+            const PrimInfo* ref = &refs[i];
+            int first = sah_bin_index(vec3_axis(ref->bounds.min, axis), lo, inv_width, bins);
+            int last = sah_bin_index(vec3_axis(ref->bounds.max, axis), lo, inv_width, bins);
+            if (last < first) last = first;
+            for (int k = first; k <= last; k++) {
+                float blo = (k == 0) ? lo : lo + k * width;
+                float bhi = (k == bins - 1) ? vec3_axis(bounds.max, axis) : lo + (k + 1) * width;
+                AABB clipped = (first == last) ? ref->bounds : clip_prim(b->ctx->mesh, ref->index, ref->bounds, axis, blo, bhi);
+                if (aabb_valid(clipped)) bin[k].bounds = aabb_union(bin[k].bounds, clipped);
+            }
+            bin[first].entries++;
+            bin[last].exits++;
+        }
+
+        AABB right_bounds[MAX_SAH_BINS];
+        int right_count[MAX_SAH_BINS];
+        AABB acc = aabb_empty();
+        int count = 0;
+        for (int k = bins - 1; k > 0; k--) {
+            acc = aabb_union(acc, bin[k].bounds);
+            count += bin[k].exits;
+            right_bounds[k] = acc;
+            right_count[k] = count;
+        }
+
+        acc = aabb_empty();
+        count = 0;
+        for (int k = 0; k < bins - 1; k++) {
+            acc = aabb_union(acc, bin[k].bounds);
+            count += bin[k].entries;
+            if (count == 0 || right_count[k + 1] == 0) continue;
+            float cost = opt->traversal_cost + opt->intersection_cost * inv_area *
+                         (count * aabb_surface_area(acc) + right_count[k + 1] * aabb_surface_area(right_bounds[k + 1]));
+            if (cost < best.cost) {
+                best = (SpatialSplit){axis, lo + (k + 1) * width, cost, acc, right_bounds[k + 1], count, right_count[k + 1]};
+            }
+        }
+    }
+    return best;
+}
+
+static void split_spatial(SBVHBuilder* b, const PrimInfo* refs, int n, SpatialSplit split,
+                          PrimInfo* left, int* left_n, PrimInfo* right, int* right_n) {
+    int nl = 0, nr = 0;
+    for (int i = 0; i < n; i++) {
+        const PrimInfo* ref = &refs[i];
+        if (vec3_axis(ref->bounds.max, split.axis) <= split.pos) left[nl++] = *ref;
+        else if (vec3_axis(ref->bounds.min, split.axis) >= split.pos) right[nr++] = *ref;
+    }
+
+    AABB lb = split.left, rb = split.right;
+    int cl = split.left_count, cr = split.right_count;
+    for (int i = 0; i < n; i++) {
+        const PrimInfo* ref = &refs[i];
+        if (vec3_axis(ref->bounds.max, split.axis) <= split.pos || vec3_axis(ref->bounds.min, split.axis) >= split.pos) continue;
+
+        AABB l = clip_prim(b->ctx->mesh, ref->index, ref->bounds, split.axis, -MAX_FLOAT, split.pos);
+        AABB r = clip_prim(b->ctx->mesh, ref->index, ref->bounds, split.axis, split.pos, MAX_FLOAT);
+        if (!aabb_valid(l)) { right[nr++] = *ref; continue; }
+        if (!aabb_valid(r)) { left[nl++] = *ref; continue; }
+
+        float c_split = aabb_surface_area(lb) * cl + aabb_surface_area(rb) * cr;
+        float c_left = aabb_surface_area(aabb_union(lb, ref->bounds)) * cl + aabb_surface_area(rb) * (cr - 1);
+        float c_right = aabb_surface_area(lb) * (cl - 1) + aabb_surface_area(aabb_union(rb, ref->bounds)) * cr;
+        bool budget = b->ref_count < b->max_refs;
+
+        if (!budget || c_left < c_split || c_right < c_split) {
+            if (c_left <= c_right) {
+                left[nl++] = *ref;
+                lb = aabb_union(lb, ref->bounds);
+                cr--;
+            } else {
+                right[nr++] = *ref;
+                rb = aabb_union(rb, ref->bounds);
+                cl--;
+            }
+        } else {
+            left[nl++] = make_ref(ref->index, l);
+            right[nr++] = make_ref(ref->index, r);
+            b->ref_count++;
+        }
+    }
+    *left_n = nl;
+    *right_n = nr;
+}
+
+static BVHBuildNode* make_ref_leaf(BuildContext* ctx, BVHBuildNode* node, const PrimInfo* refs, int n) {
+    int offset = atomic_fetch_add(&ctx->index_count, n);
+    node->first_prim_offset = offset;
+    node->prim_count = n;
+    for (int i = 0; i < n; i++) ctx->indices[offset + i] = refs[i].index;
+    return node;
+}
+
+static BVHBuildNode* build_sbvh_recursive(SBVHBuilder* b, PrimInfo* refs, int n) {
+    BuildContext* ctx = b->ctx;
+    const BVHBuildOptions* opt = ctx->options;
+    BVHBuildNode* node = alloc_node(ctx);
+
+    AABB bounds = aabb_empty(), centroid_bounds = aabb_empty();
+    for (int i = 0; i < n; i++) {
+        bounds = aabb_union(bounds, refs[i].bounds);
+        centroid_bounds = aabb_extend(centroid_bounds, refs[i].centroid);
+    }
+    node->bounds = bounds;
+    if (n == 1) {
+        make_ref_leaf(ctx, node, refs, n);
+        free(refs);
+        return node;
+    }
+
+    SAHSplit object = bvh_find_sah_split(opt, refs, 0, n, bounds, centroid_bounds, b->bins, 1);
+    SpatialSplit spatial = {-1, 0.0f, MAX_FLOAT, aabb_empty(), aabb_empty(), 0, 0};
+    float overlap = (object.axis >= 0) ? aabb_surface_area(aabb_intersect(object.left, object.right)) : b->root_area;
+    if (b->ref_count < b->max_refs && overlap / b->root_area > opt->spatial_split_alpha) {
+        spatial = find_spatial_split(b, refs, n, bounds);
+    }
+
+    float best_cost = fminf(object.cost, spatial.cost);
+    if (n <= opt->max_leaf_prims && n <= BVH_MAX_LEAF_PRIMS && (best_cost == MAX_FLOAT || opt->intersection_cost * n <= best_cost)) {
+        make_ref_leaf(ctx, node, refs, n);
+        free(refs);
+        return node;
+    }
+
+    PrimInfo* left = (PrimInfo*)malloc(sizeof(PrimInfo) * n);
+    PrimInfo* right = (PrimInfo*)malloc(sizeof(PrimInfo) * n);
+    int nl = 0, nr = 0;
+    if (spatial.axis >= 0 && spatial.cost < object.cost) {
+        split_spatial(b, refs, n, spatial, left, &nl, right, &nr);
+        node->axis = spatial.axis;
+    }
+    if ((nl == 0 || nr == 0) && object.axis >= 0) {
+        nl = nr = 0;
+        float cmin = vec3_axis(centroid_bounds.min, object.axis);
+        float scale = b->bins / (vec3_axis(centroid_bounds.max, object.axis) - cmin);
+        for (int i = 0; i < n; i++) {
+            if (sah_bin_index(vec3_axis(refs[i].centroid, object.axis), cmin, scale, b->bins) <= object.bin) left[nl++] = refs[i];
+            else right[nr++] = refs[i];
+        }
+        node->axis = object.axis;
+    }
+    if (nl == 0 || nr == 0) {
+        nl = n / 2;
+        nr = n - nl;
+        memcpy(left, refs, sizeof(PrimInfo) * nl);
+        memcpy(right, refs + nl, sizeof(PrimInfo) * nr);
+    }
+    free(refs);
+
+    node->children[0] = build_sbvh_recursive(b, left, nl);
+    node->children[1] = build_sbvh_recursive(b, right, nr);
+    return node;
+}
+
+BVHBuildNode* bvh_build_sbvh(BuildContext* ctx, PrimInfo* prims, int count, int max_refs) {
+    SBVHBuilder b = {ctx, max_refs, count, 0.0f, 0};
+    b.bins = ctx->options->sah_bins < 2 ? 2 : (ctx->options->sah_bins > MAX_SAH_BINS ? MAX_SAH_BINS : ctx->options->sah_bins);
+
+    AABB root = aabb_empty();
+    for (int i = 0; i < count; i++) root = aabb_union(root, prims[i].bounds);
+    b.root_area = fmaxf(aabb_surface_area(root), 1e-12f);
+
+    PrimInfo* refs = (PrimInfo*)malloc(sizeof(PrimInfo) * count);
+    memcpy(refs, prims, sizeof(PrimInfo) * count);
+    atomic_store(&ctx->index_count, 0);
+    return build_sbvh_recursive(&b, refs, count);
+}
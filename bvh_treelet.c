@@ -0,0 +1,163 @@
+#include "bvh_internal.h"
+#include "parallel.h"
+#include <stdlib.h>
+
+#define TREELET_LEAVES 7
+#define TREELET_SUBSETS (1 << TREELET_LEAVES)
+
+typedef struct {
+    BVHBuildNode* base;
+    const BVHBuildOptions* options;
+    float* cost;
+    BVHBuildNode** frontier;
+} TreeletPass;
+
+typedef struct {
+    BVHBuildNode* leaves[TREELET_LEAVES];
+    BVHBuildNode* internals[TREELET_LEAVES - 1];
+    int next_internal;
+    AABB bounds[TREELET_SUBSETS];
+    float cost[TREELET_SUBSETS];
+    uint8_t split[TREELET_SUBSETS];
+} Treelet;
+
+static float compute_costs(TreeletPass* p, BVHBuildNode* node) {
+    float area = aabb_surface_area(node->bounds);
+    float cost;
+    if (node->prim_count > 0) {
+        cost = p->options->intersection_cost * node->prim_count * area;
+    } else {
+        cost = p->options->traversal_cost * area + compute_costs(p, node->children[0]) + compute_costs(p, node->children[1]);
+    }
+    p->cost[node - p->base] = cost;
+    return cost;
+}
+
+static BVHBuildNode* emit_treelet(TreeletPass* p, Treelet* t, int set, BVHBuildNode* node) {
+    if ((set & (set - 1)) == 0) return t->leaves[__builtin_ctz(set)];
+    if (!node) node = t->internals[t->next_internal++];
+    int left = t->split[set];
+    BVHBuildNode* a = emit_treelet(p, t, left, NULL);
+    BVHBuildNode* b = emit_treelet(p, t, set ^ left, NULL);
+
+    Vec3 ca = vec3_add(a->bounds.min, a->bounds.max), cb = vec3_add(b->bounds.min, b->bounds.max);
+    Vec3 d = vec3_sub(cb, ca);
+    int axis = (fabsf(d.x) > fabsf(d.y) && fabsf(d.x) > fabsf(d.z)) ? 0 : (fabsf(d.y) > fabsf(d.z) ? 1 : 2);
+    bool swap = vec3_axis(d, axis) < 0.0f;
+    node->children[0] = swap ? b : a;
+    node->children[1] = swap ? a : b;
+    node->axis = axis;
+    node->prim_count = 0;
+    node->bounds = t->bounds[set];
+    p->cost[node - p->base] = t->cost[set];
+    return node;
+}
+
+// Grows a treelet below root by repeatedly opening the largest-area
+// interior leaf, then finds the SAH-optimal binary topology over its
+// leaves by dynamic programming over all leaf subsets.
+static void optimize_treelet(TreeletPass* p, BVHBuildNode* root) {
+    Treelet t;
+    int n = 2;
+    t.leaves[0] = root->children[0];
+    t.leaves[1] = root->children[1];
+    t.internals[0] = root;
+    t.next_internal = 1;
+    while (n < TREELET_LEAVES) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int i = 0; i < n; i++) {
+            if (t.leaves[i]->prim_count > 0) continue;
+            float area = aabb_surface_area(t.leaves[i]->bounds);
+            if (area > best_area) {
+                best_area = area;
+                best = i;
+            }
+        }
+        if (best < 0) break;
+        BVHBuildNode* opened = t.leaves[best];
+        t.internals[t.next_internal++] = opened;
+        t.leaves[best] = opened->children[0];
+        t.leaves[n++] = opened->children[1];
+    }
+    if (n < 3) return;
+
+    int full = (1 << n) - 1;
+    t.bounds[0] = aabb_empty();
+    for (int set = 1; set <= full; set++) {
+        int low = __builtin_ctz(set);
+        t.bounds[set] = aabb_union(t.bounds[set & (set - 1)], t.leaves[low]->bounds);
+        if ((set & (set - 1)) == 0) {
+            t.cost[set] = p->cost[t.leaves[low] - p->base];
+            continue;
+        }
+        float best = MAX_FLOAT;
+        int best_split = 0;
+        int low_bit = set & -set;
+        for (int part = (set - 1) & set; part > 0; part = (part - 1) & set) {
+            if (!(part & low_bit)) continue;
+            float c = t.cost[part] + t.cost[set ^ part];
+            if (c < best) {
+                best = c;
+                best_split = part;
+            }
+        }
+        t.cost[set] = p->options->traversal_cost * aabb_surface_area(t.bounds[set]) + best;
+        t.split[set] = (uint8_t)best_split;
+    }
+
+    if (t.cost[full] >= p->cost[root - p->base] * (1.0f - 1e-5f)) return;
+    t.next_internal = 1;
+    emit_treelet(p, &t, full, root);
+}
+
+static void optimize_subtree(TreeletPass* p, BVHBuildNode* node) {
+    if (node->prim_count > 0) return;
+    optimize_subtree(p, node->children[0]);
+    optimize_subtree(p, node->children[1]);
+    optimize_treelet(p, node);
+}
+
+static void optimize_frontier_range(void* arg, int thread, int begin, int end) {
+    (void)thread;
+    TreeletPass* p = (TreeletPass*)arg;
+    for (int i = begin; i < end; i++) optimize_subtree(p, p->frontier[i]);
+}
+
+static void collect_frontier(BVHBuildNode* node, int depth, int frontier_depth, BVHBuildNode** out, int* count) {
+    if (depth == frontier_depth || node->prim_count > 0) {
+        out[(*count)++] = node;
+        return;
+    }
+    collect_frontier(node->children[0], depth + 1, frontier_depth, out, count);
+    collect_frontier(node->children[1], depth + 1, frontier_depth, out, count);
+}
+
+static void optimize_top(TreeletPass* p, BVHBuildNode* node, int depth, int frontier_depth) {
+    if (depth == frontier_depth || node->prim_count > 0) return;
+    optimize_top(p, node->children[0], depth + 1, frontier_depth);
+    optimize_top(p, node->children[1], depth + 1, frontier_depth);
+    optimize_treelet(p, node);
+}
+
+// Subtrees below a fixed frontier depth are independent and optimized in
+// parallel; the few treelets above the frontier are done afterwards.
+void bvh_optimize_treelets(BuildContext* ctx, BVHBuildNode* root, int passes, int threads, float* sah_before, float* sah_after) {
+    int node_count = atomic_load(&ctx->node_count);
+    TreeletPass p = {ctx->nodes, ctx->options, (float*)malloc(sizeof(float) * node_count), NULL};
+    float root_area = fmaxf(aabb_surface_area(root->bounds), 1e-12f);
+    *sah_before = compute_costs(&p, root) / root_area;
+
+    int frontier_depth = 0;
+    while ((1 << frontier_depth) < threads * 4 && frontier_depth < 16) frontier_depth++;
+    p.frontier = (BVHBuildNode**)malloc(sizeof(BVHBuildNode*) << frontier_depth);
+    for (int pass = 0; pass < passes; pass++) {
+        int count = 0;
+        collect_frontier(root, 0, frontier_depth, p.frontier, &count);
+        parallel_for(count, threads, 1, optimize_frontier_range, &p);
+        optimize_top(&p, root, 0, frontier_depth);
+    }
+    *sah_after = p.cost[root - p.base] / root_area;
+    free(p.frontier);
+    free(p.cost);
+}
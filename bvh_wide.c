@@ -0,0 +1,615 @@
+#include "bvh_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDE_STACK_SIZE 256
+
+typedef struct {
+    int node;
+    int count;
+    float t;
+} WideEntry;
+
+typedef struct {
+    float* bounds;
+    int32_t* child;
+    uint16_t* prim_count;
+    uint8_t* child_count;
+} WideView;
+
+static WideView wide_view(void* nodes, int width, int index) {
+    if (width == 4) {
+        BVH4Node* n = (BVH4Node*)nodes + index;
+        return (WideView){&n->bounds[0][0], n->child, n->prim_count, &n->child_count};
+    }
+    BVH8Node* n = (BVH8Node*)nodes + index;
+    return (WideView){&n->bounds[0][0], n->child, n->prim_count, &n->child_count};
+}
+
+const char* bvh_isa_name(BVHIsa isa) {
+    switch (isa) {
+        case BVH_ISA_SSE: return "SSE";
+        case BVH_ISA_AVX: return "AVX";
+        default: return "scalar";
+    }
+}
+
+static int collapse_children(const BVHNode* nodes, int node, int width, int out[8]) {
+    out[0] = node + 1;
+    out[1] = nodes[node].second_child_offset;
+    int n = 2;
+    while (n < width) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int i = 0; i < n; i++) {
+            if (nodes[out[i]].prim_count > 0) continue;
+            float area = aabb_surface_area(nodes[out[i]].bounds);
+            if (area > best_area) {
+                best_area = area;
+                best = i;
+            }
+        }
+        if (best < 0) break;
+        int c = out[best];
+        out[best] = c + 1;
+        out[n++] = nodes[c].second_child_offset;
+    }
+    return n;
+}
+
+static int build_wide_recursive(BVH* bvh, int node) {
+    int index = bvh->wide_node_count++;
+    int width = bvh->width;
+    int children[8];
+    int n;
+    if (bvh->nodes[node].prim_count > 0) {
+        children[0] = node;
+        n = 1;
+    } else {
+        n = collapse_children(bvh->nodes, node, width, children);
+    }
+
+    WideView view = wide_view(bvh->wide_nodes, width, index);
+    for (int i = 0; i < width; i++) {
+        for (int k = 0; k < 3; k++) {
+            view.bounds[k * width + i] = MAX_FLOAT;
+            view.bounds[(k + 3) * width + i] = -MAX_FLOAT;
+        }
+        view.child[i] = -1;
+        view.prim_count[i] = 0;
+    }
+    *view.child_count = (uint8_t)n;
+
+    for (int i = 0; i < n; i++) {
+        const BVHNode* c = &bvh->nodes[children[i]];
+        view.bounds[0 * width + i] = c->bounds.min.x;
+        view.bounds[1 * width + i] = c->bounds.min.y;
+        view.bounds[2 * width + i] = c->bounds.min.z;
+        view.bounds[3 * width + i] = c->bounds.max.x;
+        view.bounds[4 * width + i] = c->bounds.max.y;
+        view.bounds[5 * width + i] = c->bounds.max.z;
+        if (c->prim_count > 0) {
+            view.child[i] = c->prim_offset;
+            view.prim_count[i] = c->prim_count;
+        } else {
+            view.child[i] = build_wide_recursive(bvh, children[i]);
+        }
+    }
+    return index;
+}
+
+static inline float exponent_scale(int e) {
+    union { uint32_t u; float f; } bits = {(uint32_t)(e + 127) << 23};
+    return bits.f;
+}
+
+static inline float dequantize(float origin, int e, int q) {
+    return origin + (float)q * exponent_scale(e);
+}
+
+// Child bounds are rounded outwards and re-checked against the decoded
+// value, widening the grid when 255 steps cannot reach the parent extent.
+static void quantize_node(BVH4QNode* q, const AABB* bounds, int n) {
+    AABB parent = aabb_empty();
+    for (int i = 0; i < n; i++) parent = aabb_union(parent, bounds[i]);
+
+    for (int axis = 0; axis < 3; axis++) {
+        float origin = vec3_axis(parent.min, axis);
+        float extent = vec3_axis(parent.max, axis) - origin;
+        int e = -100;
+        if (extent > 0.0f) {
+            frexpf(extent / 255.0f, &e);
+            if (e < -100) e = -100;
+        }
+        q->origin[axis] = origin;
+        for (;; e++) {
+            bool fits = true;
+            for (int i = 0; i < 4; i++) {
+                if (i >= n) {
+                    q->lo[axis][i] = 1;
+                    q->hi[axis][i] = 0;
+                    continue;
+                }
+                float scale = exponent_scale(e);
+                float bmin = vec3_axis(bounds[i].min, axis), bmax = vec3_axis(bounds[i].max, axis);
+                int lo = (int)floorf((bmin - origin) / scale);
+                int hi = (int)ceilf((bmax - origin) / scale);
+                lo = lo < 0 ? 0 : (lo > 255 ? 255 : lo);
+                hi = hi < 0 ? 0 : (hi > 255 ? 255 : hi);
+                while (lo > 0 && dequantize(origin, e, lo) > bmin) lo--;
+                while (hi < 255 && dequantize(origin, e, hi) < bmax) hi++;
+                if (dequantize(origin, e, hi) < bmax) fits = false;
+                q->lo[axis][i] = (uint8_t)lo;
+                q->hi[axis][i] = (uint8_t)hi;
+            }
+            if (fits || e >= 127) break;
+        }
+        q->exponent[axis] = (int8_t)e;
+    }
+}
+
+static int build_qwide_recursive(BVH* bvh, int node) {
+    int index = bvh->wide_node_count++;
+    int children[8];
+    int n;
+    if (bvh->nodes[node].prim_count > 0) {
+        children[0] = node;
+        n = 1;
+    } else {
+        n = collapse_children(bvh->nodes, node, 4, children);
+    }
+
+    BVH4QNode* q = (BVH4QNode*)bvh->wide_nodes + index;
+    AABB bounds[4];
+    q->child_count = (uint8_t)n;
+    for (int i = 0; i < 4; i++) {
+        q->child[i] = -1;
+        q->prim_count[i] = 0;
+        if (i < n) bounds[i] = bvh->nodes[children[i]].bounds;
+    }
+    quantize_node(q, bounds, n);
+
+    for (int i = 0; i < n; i++) {
+        const BVHNode* c = &bvh->nodes[children[i]];
+        if (c->prim_count > 0) {
+            q->child[i] = c->prim_offset;
+            q->prim_count[i] = c->prim_count;
+        } else {
+            q->child[i] = build_qwide_recursive(bvh, children[i]);
+        }
+    }
+    return index;
+}
+
+BVHIsa bvh_wide_isa(int width) {
+#ifdef BVH_X86
+    if (width == 4) return BVH_ISA_SSE;
+    if (width == 8) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx")) return BVH_ISA_AVX;
+    }
+#endif
+    return BVH_ISA_SCALAR;
+}
+
+void bvh_build_wide(BVH* bvh) {
+    int width = bvh->options.width;
+    bool avx = false;
+#ifdef BVH_X86
+    __builtin_cpu_init();
+    avx = __builtin_cpu_supports("avx");
+#endif
+    if (bvh->options.compress_nodes) width = 4;
+    if (width == 0) width = avx ? 8 : 4;
+    if (width != 4 && width != 8) width = 2;
+
+    bvh->width = width;
+    bvh->isa = BVH_ISA_SCALAR;
+    bvh->compressed = false;
+    bvh->wide_nodes = NULL;
+    bvh->wide_node_count = 0;
+    if (width == 2 || !bvh->nodes) return;
+
+    bvh->isa = bvh_wide_isa(width);
+    if (bvh->options.compress_nodes) {
+        bvh->compressed = true;
+        bvh->wide_nodes = aligned_alloc(64, sizeof(BVH4QNode) * bvh->node_count);
+        build_qwide_recursive(bvh, 0);
+        return;
+    }
+    size_t node_size = (width == 4) ? sizeof(BVH4Node) : sizeof(BVH8Node);
+    bvh->wide_nodes = aligned_alloc(64, node_size * bvh->node_count);
+    build_wide_recursive(bvh, 0);
+}
+
+void bvh_refit_wide(BVH* bvh) {
+    int width = bvh->width;
+    if (!bvh->wide_nodes) return;
+    if (bvh->compressed) {
+        bvh->wide_node_count = 0;
+        build_qwide_recursive(bvh, 0);
+        return;
+    }
+    for (int index = bvh->wide_node_count - 1; index >= 0; index--) {
+        WideView view = wide_view(bvh->wide_nodes, width, index);
+        for (int i = 0; i < *view.child_count; i++) {
+            AABB b = aabb_empty();
+            if (view.prim_count[i] > 0) {
+                for (int k = 0; k < view.prim_count[i]; k++) {
+                    b = aabb_union(b, prim_bounds(&bvh->mesh, bvh->prim_indices[view.child[i] + k]));
+                }
+            } else {
+                WideView c = wide_view(bvh->wide_nodes, width, view.child[i]);
+                for (int j = 0; j < *c.child_count; j++) {
+                    b.min = vec3_min(b.min, (Vec3){c.bounds[0 * width + j], c.bounds[1 * width + j], c.bounds[2 * width + j]});
+                    b.max = vec3_max(b.max, (Vec3){c.bounds[3 * width + j], c.bounds[4 * width + j], c.bounds[5 * width + j]});
+                }
+            }
+            view.bounds[0 * width + i] = b.min.x;
+            view.bounds[1 * width + i] = b.min.y;
+            view.bounds[2 * width + i] = b.min.z;
+            view.bounds[3 * width + i] = b.max.x;
+            view.bounds[4 * width + i] = b.max.y;
+            view.bounds[5 * width + i] = b.max.z;
+        }
+    }
+}
+
+static inline int push_sorted(WideEntry* stack, int sp, unsigned mask, const float* tnear,
+                              const int32_t* child, const uint16_t* prim_count, WideEntry* next) {
+    int first = __builtin_ctz(mask);
+    mask &= mask - 1;
+    if (!mask) {
+        *next = (WideEntry){child[first], prim_count[first], tnear[first]};
+        return sp;
+    }
+    WideEntry hits[8];
+    int n = 1;
+    hits[0] = (WideEntry){child[first], prim_count[first], tnear[first]};
+    while (mask) {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        WideEntry e = {child[i], prim_count[i], tnear[i]};
+        int j = n++;
+        while (j > 0 && hits[j - 1].t < e.t) {
+            hits[j] = hits[j - 1];
+            j--;
+        }
+        hits[j] = e;
+    }
+    for (int i = 0; i < n - 1; i++) stack[sp++] = hits[i];
+    *next = hits[n - 1];
+    return sp;
+}
+
+static inline bool pop_entry(const WideEntry* stack, int* sp, float closest_t, WideEntry* next) {
+    while (*sp > 0) {
+        *next = stack[--(*sp)];
+        if (next->t <= closest_t) return true;
+    }
+    return false;
+}
+
+typedef struct {
+    Vec3 origin, inv;
+    int nx, ny, nz, fx, fy, fz;
+} WideRay;
+
+static inline WideRay wide_ray(Ray r) {
+    WideRay wr;
+    wr.origin = r.origin;
+    wr.inv = (Vec3){safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+    wr.nx = wr.inv.x < 0.0f ? 3 : 0;
+    wr.ny = wr.inv.y < 0.0f ? 4 : 1;
+    wr.nz = wr.inv.z < 0.0f ? 5 : 2;
+    wr.fx = 3 - wr.nx;
+    wr.fy = 5 - wr.ny;
+    wr.fz = 7 - wr.nz;
+    return wr;
+}
+
+static inline unsigned test_node_scalar(WideView n, int width, const WideRay* wr, float t_min, float t_max, float* tnear) {
+    const float* b = n.bounds;
+    unsigned mask = 0;
+    for (int i = 0; i < *n.child_count; i++) {
+        float t0 = fmaxf(fmaxf((b[wr->nx * width + i] - wr->origin.x) * wr->inv.x, (b[wr->ny * width + i] - wr->origin.y) * wr->inv.y),
+                         fmaxf((b[wr->nz * width + i] - wr->origin.z) * wr->inv.z, t_min));
+        float t1 = fminf(fminf((b[wr->fx * width + i] - wr->origin.x) * wr->inv.x, (b[wr->fy * width + i] - wr->origin.y) * wr->inv.y),
+                         fminf((b[wr->fz * width + i] - wr->origin.z) * wr->inv.z, t_max));
+        tnear[i] = t0;
+        if (t0 <= t1) mask |= 1u << i;
+    }
+    return mask;
+}
+
+#ifdef BVH_X86
+static inline unsigned test_node4_sse(const BVH4Node* n, const WideRay* wr, float t_min, float t_max, float* tnear) {
+    __m128 ox = _mm_set1_ps(wr->origin.x), oy = _mm_set1_ps(wr->origin.y), oz = _mm_set1_ps(wr->origin.z);
+    __m128 ix = _mm_set1_ps(wr->inv.x), iy = _mm_set1_ps(wr->inv.y), iz = _mm_set1_ps(wr->inv.z);
+    __m128 t0 = _mm_max_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(n->bounds[wr->nx]), ox), ix),
+                                      _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n->bounds[wr->ny]), oy), iy)),
+                           _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(n->bounds[wr->nz]), oz), iz), _mm_set1_ps(t_min)));
+    __m128 t1 = _mm_min_ps(_mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(n->bounds[wr->fx]), ox), ix),
+                                      _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n->bounds[wr->fy]), oy), iy)),
+                           _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(n->bounds[wr->fz]), oz), iz), _mm_set1_ps(t_max)));
+    _mm_storeu_ps(tnear, t0);
+    return (unsigned)_mm_movemask_ps(_mm_cmple_ps(t0, t1)) & ((1u << n->child_count) - 1);
+}
+
+__attribute__((target("avx")))
+static inline unsigned test_node8_avx(const BVH8Node* n, const WideRay* wr, float t_min, float t_max, float* tnear) {
+    __m256 ox = _mm256_set1_ps(wr->origin.x), oy = _mm256_set1_ps(wr->origin.y), oz = _mm256_set1_ps(wr->origin.z);
+    __m256 ix = _mm256_set1_ps(wr->inv.x), iy = _mm256_set1_ps(wr->inv.y), iz = _mm256_set1_ps(wr->inv.z);
+    __m256 t0 = _mm256_max_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n->bounds[wr->nx]), ox), ix),
+                                            _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n->bounds[wr->ny]), oy), iy)),
+                              _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n->bounds[wr->nz]), oz), iz),
+                                            _mm256_set1_ps(t_min)));
+    __m256 t1 = _mm256_min_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n->bounds[wr->fx]), ox), ix),
+                                            _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n->bounds[wr->fy]), oy), iy)),
+                              _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n->bounds[wr->fz]), oz), iz),
+                                            _mm256_set1_ps(t_max)));
+    _mm256_storeu_ps(tnear, t0);
+    return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)) & ((1u << n->child_count) - 1);
+}
+#endif
+
+// Bounds are decoded straight into slab distances: t = q * (scale / d) + (origin - o) / d.
+static inline unsigned test_qnode_scalar(const BVH4QNode* n, const WideRay* wr, float t_min, float t_max, float* tnear) {
+    const float* o = &wr->origin.x;
+    const float* inv = &wr->inv.x;
+    int neg[3] = {wr->nx == 3, wr->ny == 4, wr->nz == 5};
+    float a[3], b[3];
+    for (int k = 0; k < 3; k++) {
+        a[k] = exponent_scale(n->exponent[k]) * inv[k];
+        b[k] = (n->origin[k] - o[k]) * inv[k];
+    }
+    unsigned mask = 0;
+    for (int i = 0; i < n->child_count; i++) {
+        float t0 = t_min, t1 = t_max;
+        for (int k = 0; k < 3; k++) {
+            float near = (neg[k] ? n->hi[k][i] : n->lo[k][i]) * a[k] + b[k];
+            float far = (neg[k] ? n->lo[k][i] : n->hi[k][i]) * a[k] + b[k];
+            t0 = fmaxf(t0, near);
+            t1 = fminf(t1, far);
+        }
+        tnear[i] = t0;
+        if (t0 <= t1) mask |= 1u << i;
+    }
+    return mask;
+}
+
+#ifdef BVH_X86
+static inline __m128 qnode_plane(const uint8_t* q, __m128 a, __m128 b) {
+    int32_t packed;
+    memcpy(&packed, q, sizeof(packed));
+    __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+    return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), a), b);
+}
+
+static inline unsigned test_qnode4_sse(const BVH4QNode* n, const WideRay* wr, float t_min, float t_max, float* tnear) {
+    __m128 ax = _mm_set1_ps(exponent_scale(n->exponent[0]) * wr->inv.x);
+    __m128 ay = _mm_set1_ps(exponent_scale(n->exponent[1]) * wr->inv.y);
+    __m128 az = _mm_set1_ps(exponent_scale(n->exponent[2]) * wr->inv.z);
+    __m128 bx = _mm_set1_ps((n->origin[0] - wr->origin.x) * wr->inv.x);
+    __m128 by = _mm_set1_ps((n->origin[1] - wr->origin.y) * wr->inv.y);
+    __m128 bz = _mm_set1_ps((n->origin[2] - wr->origin.z) * wr->inv.z);
+    const uint8_t* nx = wr->nx == 3 ? n->hi[0] : n->lo[0];
+    const uint8_t* ny = wr->ny == 4 ? n->hi[1] : n->lo[1];
+    const uint8_t* nz = wr->nz == 5 ? n->hi[2] : n->lo[2];
+    const uint8_t* fx = wr->nx == 3 ? n->lo[0] : n->hi[0];
+    const uint8_t* fy = wr->ny == 4 ? n->lo[1] : n->hi[1];
+    const uint8_t* fz = wr->nz == 5 ? n->lo[2] : n->hi[2];
+    __m128 t0 = _mm_max_ps(_mm_max_ps(qnode_plane(nx, ax, bx), qnode_plane(ny, ay, by)),
+                           _mm_max_ps(qnode_plane(nz, az, bz), _mm_set1_ps(t_min)));
+    __m128 t1 = _mm_min_ps(_mm_min_ps(qnode_plane(fx, ax, bx), qnode_plane(fy, ay, by)),
+                           _mm_min_ps(qnode_plane(fz, az, bz), _mm_set1_ps(t_max)));
+    _mm_storeu_ps(tnear, t0);
+    return (unsigned)_mm_movemask_ps(_mm_cmple_ps(t0, t1)) & ((1u << n->child_count) - 1);
+}
+#endif
+
+static inline unsigned test_qnode4(const BVH4QNode* n, const WideRay* wr, float t_min, float t_max, float* tnear) {
+#ifdef BVH_X86
+    return test_qnode4_sse(n, wr, t_min, t_max, tnear);
+#else
+    return test_qnode_scalar(n, wr, t_min, t_max, tnear);
+#endif
+}
+
+static inline bool occlude_children(const BVH* bvh, Ray r, float t_min, float t_max, unsigned mask,
+                                    const int32_t* child, const uint16_t* prim_count, int* stack, int* sp) {
+    while (mask) {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if (prim_count[i] == 0) stack[(*sp)++] = child[i];
+        else if (occluded_leaf(bvh, r, child[i], prim_count[i], t_min, t_max)) return true;
+    }
+    return false;
+}
+
+static bool intersect_wide_scalar(const BVH* bvh, Ray r, float t_min, float t_max, float* t, int* tri_index, float* u, float* v) {
+    int width = bvh->width;
+    WideRay wr = wide_ray(r);
+    WideEntry stack[WIDE_STACK_SIZE];
+    int sp = 0;
+    WideEntry e = {0, 0, t_min};
+    float closest_t = t_max;
+    bool hit = false;
+
+    while (true) {
+        if (e.count > 0) {
+            hit |= intersect_leaf(bvh, r, e.node, e.count, t_min, &closest_t, tri_index, u, v);
+            if (!pop_entry(stack, &sp, closest_t, &e)) break;
+            continue;
+        }
+        WideView n = wide_view(bvh->wide_nodes, width, e.node);
+        float tnear[8];
+        unsigned mask = test_node_scalar(n, width, &wr, t_min, closest_t, tnear);
+        if (mask) sp = push_sorted(stack, sp, mask, tnear, n.child, n.prim_count, &e);
+        else if (!pop_entry(stack, &sp, closest_t, &e)) break;
+    }
+    if (hit) *t = closest_t;
+    return hit;
+}
+
+static bool occluded_wide_scalar(const BVH* bvh, Ray r, float t_min, float t_max) {
+    int width = bvh->width;
+    WideRay wr = wide_ray(r);
+    int stack[WIDE_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        WideView n = wide_view(bvh->wide_nodes, width, stack[--sp]);
+        float tnear[8];
+        unsigned mask = test_node_scalar(n, width, &wr, t_min, t_max, tnear);
+        if (occlude_children(bvh, r, t_min, t_max, mask, n.child, n.prim_count, stack, &sp)) return true;
+    }
+    return false;
+}
+
+#ifdef BVH_X86
+static bool intersect_wide4_sse(const BVH* bvh, Ray r, float t_min, float t_max, float* t, int* tri_index, float* u, float* v) {
+    const BVH4Node* nodes = (const BVH4Node*)bvh->wide_nodes;
+    WideRay wr = wide_ray(r);
+    WideEntry stack[WIDE_STACK_SIZE];
+    int sp = 0;
+    WideEntry e = {0, 0, t_min};
+    float closest_t = t_max;
+    bool hit = false;
+
+    while (true) {
+        if (e.count > 0) {
+            hit |= intersect_leaf(bvh, r, e.node, e.count, t_min, &closest_t, tri_index, u, v);
+            if (!pop_entry(stack, &sp, closest_t, &e)) break;
+            continue;
+        }
+        const BVH4Node* n = &nodes[e.node];
+        float tnear[4];
+        unsigned mask = test_node4_sse(n, &wr, t_min, closest_t, tnear);
+        if (mask) sp = push_sorted(stack, sp, mask, tnear, n->child, n->prim_count, &e);
+        else if (!pop_entry(stack, &sp, closest_t, &e)) break;
+    }
+    if (hit) *t = closest_t;
+    return hit;
+}
+
+static bool occluded_wide4_sse(const BVH* bvh, Ray r, float t_min, float t_max) {
+    const BVH4Node* nodes = (const BVH4Node*)bvh->wide_nodes;
+    WideRay wr = wide_ray(r);
+    int stack[WIDE_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        const BVH4Node* n = &nodes[stack[--sp]];
+        float tnear[4];
+        unsigned mask = test_node4_sse(n, &wr, t_min, t_max, tnear);
+        if (occlude_children(bvh, r, t_min, t_max, mask, n->child, n->prim_count, stack, &sp)) return true;
+    }
+    return false;
+}
+
+__attribute__((target("avx")))
+static bool intersect_wide8_avx(const BVH* bvh, Ray r, float t_min, float t_max, float* t, int* tri_index, float* u, float* v) {
+    const BVH8Node* nodes = (const BVH8Node*)bvh->wide_nodes;
+    WideRay wr = wide_ray(r);
+    WideEntry stack[WIDE_STACK_SIZE];
+    int sp = 0;
+    WideEntry e = {0, 0, t_min};
+    float closest_t = t_max;
+    bool hit = false;
+
+    while (true) {
+        if (e.count > 0) {
+            hit |= intersect_leaf(bvh, r, e.node, e.count, t_min, &closest_t, tri_index, u, v);
+            if (!pop_entry(stack, &sp, closest_t, &e)) break;
+            continue;
+        }
+        const BVH8Node* n = &nodes[e.node];
+        float tnear[8];
+        unsigned mask = test_node8_avx(n, &wr, t_min, closest_t, tnear);
+        if (mask) sp = push_sorted(stack, sp, mask, tnear, n->child, n->prim_count, &e);
+        else if (!pop_entry(stack, &sp, closest_t, &e)) break;
+    }
+    if (hit) *t = closest_t;
+    return hit;
+}
+
+__attribute__((target("avx")))
+static bool occluded_wide8_avx(const BVH* bvh, Ray r, float t_min, float t_max) {
+    const BVH8Node* nodes = (const BVH8Node*)bvh->wide_nodes;
+    WideRay wr = wide_ray(r);
+    int stack[WIDE_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        const BVH8Node* n = &nodes[stack[--sp]];
+        float tnear[8];
+        unsigned mask = test_node8_avx(n, &wr, t_min, t_max, tnear);
+        if (occlude_children(bvh, r, t_min, t_max, mask, n->child, n->prim_count, stack, &sp)) return true;
+    }
+    return false;
+}
+#endif
+
+static bool intersect_qwide4(const BVH* bvh, Ray r, float t_min, float t_max, float* t, int* tri_index, float* u, float* v) {
+    const BVH4QNode* nodes = (const BVH4QNode*)bvh->wide_nodes;
+    WideRay wr = wide_ray(r);
+    WideEntry stack[WIDE_STACK_SIZE];
+    int sp = 0;
+    WideEntry e = {0, 0, t_min};
+    float closest_t = t_max;
+    bool hit = false;
+
+    while (true) {
+        if (e.count > 0) {
+            hit |= intersect_leaf(bvh, r, e.node, e.count, t_min, &closest_t, tri_index, u, v);
+            if (!pop_entry(stack, &sp, closest_t, &e)) break;
+            continue;
+        }
+        const BVH4QNode* n = &nodes[e.node];
+        float tnear[4];
+        unsigned mask = test_qnode4(n, &wr, t_min, closest_t, tnear);
+        if (mask) sp = push_sorted(stack, sp, mask, tnear, n->child, n->prim_count, &e);
+        else if (!pop_entry(stack, &sp, closest_t, &e)) break;
+    }
+    if (hit) *t = closest_t;
+    return hit;
+}
+
+static bool occluded_qwide4(const BVH* bvh, Ray r, float t_min, float t_max) {
+    const BVH4QNode* nodes = (const BVH4QNode*)bvh->wide_nodes;
+    WideRay wr = wide_ray(r);
+    int stack[WIDE_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        const BVH4QNode* n = &nodes[stack[--sp]];
+        float tnear[4];
+        unsigned mask = test_qnode4(n, &wr, t_min, t_max, tnear);
+        if (occlude_children(bvh, r, t_min, t_max, mask, n->child, n->prim_count, stack, &sp)) return true;
+    }
+    return false;
+}
+
+bool bvh_intersect_wide(const BVH* bvh, Ray r, float t_min, float t_max, float* t, int* tri_index, float* u, float* v) {
+    if (bvh->compressed) return intersect_qwide4(bvh, r, t_min, t_max, t, tri_index, u, v);
+#ifdef BVH_X86
+    if (bvh->isa == BVH_ISA_SSE) return intersect_wide4_sse(bvh, r, t_min, t_max, t, tri_index, u, v);
+    if (bvh->isa == BVH_ISA_AVX) return intersect_wide8_avx(bvh, r, t_min, t_max, t, tri_index, u, v);
+#endif
+    return intersect_wide_scalar(bvh, r, t_min, t_max, t, tri_index, u, v);
+}
+
+bool bvh_occluded_wide(const BVH* bvh, Ray r, float t_min, float t_max) {
+    if (bvh->compressed) return occluded_qwide4(bvh, r, t_min, t_max);
+#ifdef BVH_X86
+    if (bvh->isa == BVH_ISA_SSE) return occluded_wide4_sse(bvh, r, t_min, t_max);
+    if (bvh->isa == BVH_ISA_AVX) return occluded_wide8_avx(bvh, r, t_min, t_max);
+#endif
+    return occluded_wide_scalar(bvh, r, t_min, t_max);
+}
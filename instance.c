@@ -0,0 +1,125 @@
+#include "instance.h"
+#include "bvh_internal.h"
+#include <stdlib.h>
+
+Instance instance_make(int mesh_id, Mat3 linear, Vec3 translation) {
+    Instance inst;
+    inst.mesh_id = mesh_id;
+    inst.linear = linear;
+    inst.inv_linear = mat3_inverse(linear);
+    inst.translation = translation;
+    inst.bounds = aabb_empty();
+    return inst;
+}
+
+void instance_update_bounds(Instance* inst, const Mesh* mesh) {
+    inst->bounds = aabb_empty();
+    if (!mesh->bvh.nodes) return;
+    AABB local = mesh->bvh.nodes[0].bounds;
+    for (int i = 0; i < 8; i++) {
+        Vec3 corner = {(i & 1) ? local.max.x : local.min.x,
+                       (i & 2) ? local.max.y : local.min.y,
+                       (i & 4) ? local.max.z : local.min.z};
+        inst->bounds = aabb_extend(inst->bounds, vec3_add(mat3_mul_vec3(inst->linear, corner), inst->translation));
+    }
+}
+
+// The direction is left unnormalized so that hit distances in object space
+// equal those along the world-space ray.
+Ray instance_to_object(const Instance* inst, Ray r) {
+    return (Ray){
+        .origin = mat3_mul_vec3(inst->inv_linear, vec3_sub(r.origin, inst->translation)),
+        .direction = mat3_mul_vec3(inst->inv_linear, r.direction)
+    };
+}
+
+Vec3 instance_normal_to_world(const Instance* inst, Vec3 n) {
+    Mat3 m = inst->inv_linear;
+    return vec3_normalize((Vec3){
+        m.m[0][0] * n.x + m.m[1][0] * n.y + m.m[2][0] * n.z,
+        m.m[0][1] * n.x + m.m[1][1] * n.y + m.m[2][1] * n.z,
+        m.m[0][2] * n.x + m.m[1][2] * n.y + m.m[2][2] * n.z
+    });
+}
+
+void tlas_build(BVH* tlas, Instance* instances, int count, const Mesh* meshes, const BVHBuildOptions* options) {
+    AABB* boxes = (AABB*)malloc(sizeof(AABB) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; i++) {
+        instance_update_bounds(&instances[i], &meshes[instances[i].mesh_id]);
+        boxes[i] = instances[i].bounds;
+    }
+    bvh_build_boxes(tlas, boxes, count, options);
+    free(boxes);
+}
+
+bool tlas_intersect(const BVH* tlas, const Instance* instances, const Mesh* meshes, Ray r, float t_min, float t_max, Hit* hit) {
+    if (!tlas->nodes) return false;
+    bool found = false;
+    float closest_t = t_max;
+    Vec3 inv_dir = {safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+    int dir_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+    int stack[64];
+    int stack_ptr = 0;
+    int current = 0;
+
+    while (true) {
+        const BVHNode* node = &tlas->nodes[current];
+        if (intersect_aabb(&node->bounds, r.origin, inv_dir, dir_neg, t_min, closest_t)) {
+            if (node->prim_count > 0) {
+                for (int i = 0; i < node->prim_count; i++) {
+                    int id = tlas->prim_indices[node->prim_offset + i];
+                    const Instance* inst = &instances[id];
+                    float t, u, v;
+                    int tri_index;
+                    if (bvh_intersect(&meshes[inst->mesh_id].bvh, instance_to_object(inst, r), t_min, closest_t, &t, &tri_index, &u, &v)) {
+                        closest_t = t;
+                        *hit = (Hit){t, u, v, tri_index, id, -1};
+                        found = true;
+                    }
+                }
+                if (stack_ptr == 0) break;
+                current = stack[--stack_ptr];
+            } else if (dir_neg[node->axis]) {
+                stack[stack_ptr++] = current + 1;
+                current = node->second_child_offset;
+            } else {
+                stack[stack_ptr++] = node->second_child_offset;
+                current = current + 1;
+            }
+        } else {
+            if (stack_ptr == 0) break;
+            current = stack[--stack_ptr];
+        }
+    }
+    return found;
+}
+
+bool tlas_occluded(const BVH* tlas, const Instance* instances, const Mesh* meshes, Ray r, float t_min, float t_max) {
+    if (!tlas->nodes) return false;
+    Vec3 inv_dir = {safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+    int dir_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+    int stack[64];
+    int stack_ptr = 0;
+    int current = 0;
+
+    while (true) {
+        const BVHNode* node = &tlas->nodes[current];
+        if (intersect_aabb(&node->bounds, r.origin, inv_dir, dir_neg, t_min, t_max)) {
+            if (node->prim_count > 0) {
+                for (int i = 0; i < node->prim_count; i++) {
+                    const Instance* inst = &instances[tlas->prim_indices[node->prim_offset + i]];
+                    if (bvh_occluded(&meshes[inst->mesh_id].bvh, instance_to_object(inst, r), t_min, t_max)) return true;
+                }
+                if (stack_ptr == 0) break;
+                current = stack[--stack_ptr];
+            } else {
+                stack[stack_ptr++] = node->second_child_offset;
+                current = current + 1;
+            }
+        } else {
+            if (stack_ptr == 0) break;
+            current = stack[--stack_ptr];
+        }
+    }
+    return false;
+}
@@ -0,0 +1,38 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "bvh.h"
+#include "mat3.h"
+
+typedef struct {
+    TriangleMesh geometry;
+    BVH bvh;
+} Mesh;
+
+typedef struct {
+    int mesh_id;
+    Mat3 linear;
+    Mat3 inv_linear;
+    Vec3 translation;
+    AABB bounds;
+} Instance;
+
+// tri_index and instance_id are -1 for hits on analytic shapes, shape_id is
+// -1 for triangle hits.
+typedef struct {
+    float t, u, v;
+    int tri_index;
+    int instance_id;
+    int shape_id;
+} Hit;
+
+Instance instance_make(int mesh_id, Mat3 linear, Vec3 translation);
+void instance_update_bounds(Instance* inst, const Mesh* mesh);
+Ray instance_to_object(const Instance* inst, Ray r);
+Vec3 instance_normal_to_world(const Instance* inst, Vec3 n);
+
+void tlas_build(BVH* tlas, Instance* instances, int count, const Mesh* meshes, const BVHBuildOptions* options);
+bool tlas_intersect(const BVH* tlas, const Instance* instances, const Mesh* meshes, Ray r, float t_min, float t_max, Hit* hit);
+bool tlas_occluded(const BVH* tlas, const Instance* instances, const Mesh* meshes, Ray r, float t_min, float t_max);
+
+#endif
@@ -28,6 +28,23 @@ Vec3 light_sample(const Light* light, Vec3 p, Sampler* sampler, Vec3* wi, float*
         Vec3 normal = vec3_normalize(vec3_sub(point_on_sphere, light->position));
         float cosine = fabsf(vec3_dot(normal, vec3_scale(*wi, -1.0f)));
         
+        *pdf = d2 / (area * cosine);
+        return light->emission;
+    } else if (light->type == LIGHT_DISK) {
+        Vec3 normal = vec3_normalize(vec3_cross(light->u, light->v));
+        Vec3 s, t;
+        vec3_coordinate_system(normal, &s, &t);
+        float r = light->radius * sqrtf(sampler_next_1d(sampler));
+        float phi = 2.0f * PI * sampler_next_1d(sampler);
+        Vec3 point_on_light = vec3_add(light->position, vec3_add(vec3_scale(s, r * cosf(phi)), vec3_scale(t, r * sinf(phi))));
+        Vec3 to_light = vec3_sub(point_on_light, p);
+        float d2 = vec3_length_sq(to_light);
+        *dist = sqrtf(d2);
+        *wi = vec3_scale(to_light, 1.0f / *dist);
+
+        float area = PI * light->radius * light->radius;
+        float cosine = fabsf(vec3_dot(normal, vec3_scale(*wi, -1.0f)));
+
         *pdf = d2 / (area * cosine);
         return light->emission;
     }
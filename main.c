@@ -1,17 +1,117 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "renderer.h"
 #include "scene.h"
 #include "camera.h"
+#include "mat3.h"
+
+// Unit sphere with shared vertices; each row wraps around at the seam. Rows
+// between the poles are quads, the pole caps triangles.
+static TriangleMesh make_sphere_mesh(int slices, int stacks, int material_id) {
+    TriangleMesh mesh;
+    mesh_init(&mesh, true);
+    for (int j = 0; j <= stacks; j++) {
+        for (int i = 0; i < slices; i++) {
+            float phi = 2.0f * PI * i / slices;
+            float theta = PI * j / stacks;
+            Vec3 p = {sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta)};
+            mesh_add_vertex(&mesh, p, p);
+        }
+    }
+    for (int j = 0; j < stacks; j++) {
+        for (int i = 0; i < slices; i++) {
+            int p0 = j * slices + i, p1 = j * slices + (i + 1) % slices;
+            int p2 = p1 + slices, p3 = p0 + slices;
+            if (j == 0) mesh_add_triangle(&mesh, p0, p3, p2, material_id);
+            else if (j == stacks - 1) mesh_add_triangle(&mesh, p0, p2, p1, material_id);
+            else mesh_add_quad(&mesh, p0, p3, p2, p1, material_id);
+        }
+    }
+    return mesh;
+}
+
+static void add_quad(TriangleMesh* mesh, Vec3 p0, Vec3 p1, Vec3 p2, Vec3 p3, Vec3 n, int material_id) {
+    int a = mesh_add_vertex(mesh, p0, n), b = mesh_add_vertex(mesh, p1, n);
+    int c = mesh_add_vertex(mesh, p2, n), d = mesh_add_vertex(mesh, p3, n);
+    mesh_add_quad(mesh, a, b, c, d, material_id);
+}
+
+static double seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Moves every mesh vertex along a travelling wave and refits the BVHs after
+// each frame; the render then sees the last frame's pose.
+static void run_refit_frames(Scene* scene, int frames) {
+    if (scene->paged.top_nodes) {
+        printf("--refit-frames is not supported with --bvh-paged\n");
+        return;
+    }
+    int mesh_total = scene->mesh_count + 1;
+    Vec3** rest = (Vec3**)malloc(sizeof(Vec3*) * mesh_total);
+    for (int m = 0; m < mesh_total; m++) {
+        TriangleMesh* mesh = m == 0 ? &scene->geometry : &scene->meshes[m - 1].geometry;
+        rest[m] = (Vec3*)malloc(sizeof(Vec3) * (mesh->vertex_count > 0 ? mesh->vertex_count : 1));
+        for (int v = 0; v < mesh->vertex_count; v++) rest[m][v] = mesh->positions[v];
+    }
+    float start_cost = bvh_sah_cost(&scene->bvh);
+    double total = 0.0;
+    int rebuilds = 0;
+    for (int f = 1; f <= frames; f++) {
+        float phase = 2.0f * PI * f / frames;
+        for (int m = 0; m < mesh_total; m++) {
+            TriangleMesh* mesh = m == 0 ? &scene->geometry : &scene->meshes[m - 1].geometry;
+            for (int v = 0; v < mesh->vertex_count; v++) {
+                Vec3 p = rest[m][v];
+                float w = 0.02f * sinf(phase + 3.0f * p.x + 2.0f * p.y);
+                mesh->positions[v] = vec3_add(p, (Vec3){w, -w, w});
+            }
+        }
+        double start = seconds();
+        if (scene_refit(scene)) rebuilds++;
+        total += seconds() - start;
+    }
+    printf("Refit: %d frames, %.3f ms per frame, %d with a rebuild, SAH cost %.3f -> %.3f\n",
+           frames, total * 1000.0 / frames, rebuilds, start_cost, bvh_sah_cost(&scene->bvh));
+    for (int m = 0; m < mesh_total; m++) free(rest[m]);
+    free(rest);
+}
 
 void print_usage(const char* prog) {
     printf("Usage: %s [options]\n", prog);
     printf("  --spp <n>       Samples per pixel (default: 16)\n");
     printf("  --threads <n>   Number of threads (default: 4)\n");
     printf("  --output <file> Output filename (default: output.exr)\n");
-    printf("  --scene <n>     Scene ID (0: Cornell Box) (default: 0)\n");
+    printf("  --scene <n>     Scene ID (0: Cornell Box, 1: Cornell Box with instanced spheres, 2: Cornell Box with analytic spheres and a sphere light) (default: 0)\n");
     printf("  --bounces <n>   Max bounces (default: 4)\n");
+    printf("  --packet <n>    Primary ray packet size: 1, 4, 8, 16 (default: 16)\n");
+    printf("  --wavefront     Use the wavefront integrator: bulk extend/shade/connect stages over SoA path queues\n");
+    printf("  --pass-spp <n>  Render progressively in passes of n spp over all tiles (default: all samples in one pass, or --min-spp with --adaptive)\n");
+    printf("  --snapshot-passes <k> Write the output images every k passes while rendering (default: off)\n");
+    printf("  --snapshot-seconds <t> Write the output images every t seconds while rendering (default: off)\n");
+    printf("  --adaptive <e>  Stop sampling pixel blocks once their relative standard error is below e; --spp is the maximum (default: off)\n");
+    printf("  --min-spp <n>   Minimum samples per pixel with --adaptive (default: 8)\n");
+    printf("  --spp-map <file> Write the per-pixel sample counts of --adaptive as a grayscale PNG\n");
+    printf("  --bvh <method>  BVH builder: midpoint, sah, lbvh, sbvh (default: sah)\n");
+    printf("  --sah-bins <n>  SAH bin count (default: 16)\n");
+    printf("  --sah-trav <c>  SAH traversal cost (default: 1.0)\n");
+    printf("  --sah-isect <c> SAH intersection cost (default: 1.0)\n");
+    printf("  --morton-bits <n> LBVH Morton code size: 30 or 63 (default: 30)\n");
+    printf("  --sbvh-dup <f>  SBVH reference duplication budget as a fraction of triangles (default: 0.3)\n");
+    printf("  --treelet <n>   Treelet restructuring passes after the build (default: 0)\n");
+    printf("  --bvh-compress  Use 64-byte 4-wide nodes with 8-bit quantized bounds\n");
+    printf("  --bvh-cache <file> Load the BVH from this cache file, or build and write it (default: off)\n");
+    printf("  --bvh-report    Compare memory and ray throughput of the BVH node layouts\n");
+    printf("  --bvh-width <n> BVH branching factor: 2, 4, 8, 0 = best for this CPU (default: 0)\n");
+    printf("  --refit-frames <n> Deform the meshes over n frames, refitting the BVHs each frame before rendering (default: 0)\n");
+    printf("  --mesh-reorder  Sort mesh primitives and vertices along a Morton curve before building the BVH\n");
+    printf("  --oct-normals   Store shading normals as 32-bit octahedral encodings\n");
+    printf("  --bvh-paged <file> Trace through an out-of-core BVH paged from this file, written first if missing; requires --wavefront (default: off)\n");
+    printf("  --bvh-paged-cache <MB> Geometry cache size for the paged BVH (default: 64)\n");
 }
 
 int main(int argc, char** argv) {
@@ -21,24 +121,69 @@ int main(int argc, char** argv) {
         .samples_per_pixel = 16,
         .max_bounces = 4,
         .num_threads = 4,
+        .packet_size = 16,
+        .min_spp = 8,
         .output_filename = "output.exr"
     };
     
     int scene_id = 0;
+    bool bvh_report = false;
+    int refit_frames = 0;
+    Scene scene;
+    scene_init(&scene);
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--spp") == 0 && i + 1 < argc) options.samples_per_pixel = atoi(argv[++i]);
         else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) options.num_threads = atoi(argv[++i]);
         else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) options.output_filename = argv[++i];
         else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) scene_id = atoi(argv[++i]);
         else if (strcmp(argv[i], "--bounces") == 0 && i + 1 < argc) options.max_bounces = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--packet") == 0 && i + 1 < argc) options.packet_size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--wavefront") == 0) options.wavefront = true;
+        else if (strcmp(argv[i], "--pass-spp") == 0 && i + 1 < argc) options.pass_spp = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--snapshot-passes") == 0 && i + 1 < argc) options.snapshot_passes = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--snapshot-seconds") == 0 && i + 1 < argc) options.snapshot_seconds = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--adaptive") == 0 && i + 1 < argc) options.adaptive_threshold = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--min-spp") == 0 && i + 1 < argc) options.min_spp = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--spp-map") == 0 && i + 1 < argc) options.spp_map_filename = argv[++i];
+        else if (strcmp(argv[i], "--bvh") == 0 && i + 1 < argc) {
+            const char* m = argv[++i];
+            if (strcmp(m, "midpoint") == 0) scene.bvh_options.method = BVH_BUILD_MIDPOINT;
+            else if (strcmp(m, "sah") == 0) scene.bvh_options.method = BVH_BUILD_SAH;
+            else if (strcmp(m, "lbvh") == 0) scene.bvh_options.method = BVH_BUILD_LBVH;
+            else if (strcmp(m, "sbvh") == 0) scene.bvh_options.method = BVH_BUILD_SBVH;
+            else { print_usage(argv[0]); return 1; }
+        }
+        else if (strcmp(argv[i], "--sah-bins") == 0 && i + 1 < argc) scene.bvh_options.sah_bins = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--sah-trav") == 0 && i + 1 < argc) scene.bvh_options.traversal_cost = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--sah-isect") == 0 && i + 1 < argc) scene.bvh_options.intersection_cost = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--morton-bits") == 0 && i + 1 < argc) scene.bvh_options.morton_bits = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--sbvh-dup") == 0 && i + 1 < argc) scene.bvh_options.max_duplication = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--treelet") == 0 && i + 1 < argc) scene.bvh_options.treelet_passes = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bvh-compress") == 0) scene.bvh_options.compress_nodes = true;
+        else if (strcmp(argv[i], "--bvh-cache") == 0 && i + 1 < argc) scene.bvh_cache_path = argv[++i];
+        else if (strcmp(argv[i], "--bvh-report") == 0) bvh_report = true;
+        else if (strcmp(argv[i], "--bvh-width") == 0 && i + 1 < argc) scene.bvh_options.width = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--refit-frames") == 0 && i + 1 < argc) refit_frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--mesh-reorder") == 0) scene.reorder_meshes = true;
+        else if (strcmp(argv[i], "--oct-normals") == 0) scene.compress_normals = true;
+        else if (strcmp(argv[i], "--bvh-paged") == 0 && i + 1 < argc) scene.paged_path = argv[++i];
+        else if (strcmp(argv[i], "--bvh-paged-cache") == 0 && i + 1 < argc) scene.paged_cache_bytes = (size_t)(atof(argv[++i]) * 1024.0 * 1024.0);
         else { print_usage(argv[0]); return 1; }
     }
+    // Only the wavefront integrator queues its bounce and shadow rays per
+    // chunk; the tile integrator would page through them one ray at a time.
+    if (scene.paged_path && !options.wavefront) {
+        printf("--bvh-paged requires --wavefront\n");
+        return 1;
+    }
+    scene.bvh_options.num_threads = options.num_threads;
+    // A single pass leaves no earlier samples to estimate a tile's variance,
+    // so adaptive rendering defaults to passes of the minimum sample count.
+    if (options.adaptive_threshold > 0.0f && options.pass_spp <= 0) options.pass_spp = options.min_spp > 0 ? options.min_spp : 1;
     
-    Scene scene;
-    scene_init(&scene);
     Camera camera;
     
-    if (scene_id == 0) {
+    if (scene_id >= 0 && scene_id <= 2) {
         Material white = { .base_color = {0.73f, 0.73f, 0.73f}, .roughness = 0.5f };
         Material red = { .base_color = {0.65f, 0.05f, 0.05f}, .roughness = 0.5f };
         Material green = { .base_color = {0.12f, 0.45f, 0.15f}, .roughness = 0.5f };
@@ -49,37 +194,68 @@ int main(int argc, char** argv) {
         scene_add_material(&scene, green);
         scene_add_material(&scene, light_mat);
         
-        Triangle t1 = { {-2,-2,0}, {2,-2,0}, {2,2,0}, {0,0,1},{0,0,1},{0,0,1}, 0 };
-        Triangle t2 = { {-2,-2,0}, {2,2,0}, {-2,2,0}, {0,0,1},{0,0,1},{0,0,1}, 0 };
-        Triangle t3 = { {-2,-2,4}, {2,2,4}, {2,-2,4}, {0,0,-1},{0,0,-1},{0,0,-1}, 0 };
-        Triangle t4 = { {-2,-2,4}, {-2,2,4}, {2,2,4}, {0,0,-1},{0,0,-1},{0,0,-1}, 0 };
-        Triangle t5 = { {-2,2,0}, {2,2,0}, {2,2,4}, {0,-1,0},{0,-1,0},{0,-1,0}, 0 };
-        Triangle t6 = { {-2,2,0}, {2,2,4}, {-2,2,4}, {0,-1,0},{0,-1,0},{0,-1,0}, 0 };
-        Triangle t7 = { {-2,-2,0}, {-2,2,0}, {-2,2,4}, {1,0,0},{1,0,0},{1,0,0}, 1 };
-        Triangle t8 = { {-2,-2,0}, {-2,2,4}, {-2,-2,4}, {1,0,0},{1,0,0},{1,0,0}, 1 };
-        Triangle t9 = { {2,-2,0}, {2,-2,4}, {2,2,4}, {-1,0,0},{-1,0,0},{-1,0,0}, 2 };
-        Triangle t10 = { {2,-2,0}, {2,2,4}, {2,2,0}, {-1,0,0},{-1,0,0},{-1,0,0}, 2 };
+        if (scene_id == 2) {
+            Light light = { .type = LIGHT_SPHERE, .position = {0, 0, 3.3f}, .radius = 0.3f, .emission = {15,15,15} };
+            scene_add_area_light(&scene, light, 3);
+        } else {
+            Light light = { .type = LIGHT_QUAD, .position = {-0.5f, -0.5f, 3.9f}, .u = {1,0,0}, .v = {0,1,0}, .emission = {15,15,15} };
+            scene_add_area_light(&scene, light, 3);
+        }
         
-        Light light = { .type = LIGHT_QUAD, .position = {-0.5f, -0.5f, 3.9f}, .u = {1,0,0}, .v = {0,1,0}, .emission = {15,15,15} };
-        scene_add_light(&scene, light);
-        
-        Triangle l1 = { {-0.5f,-0.5f,3.9f}, {0.5f,-0.5f,3.9f}, {0.5f,0.5f,3.9f}, {0,0,-1},{0,0,-1},{0,0,-1}, 3 };
-        Triangle l2 = { {-0.5f,-0.5f,3.9f}, {0.5f,0.5f,3.9f}, {-0.5f,0.5f,3.9f}, {0,0,-1},{0,0,-1},{0,0,-1}, 3 };
-        
-        scene.triangles = malloc(sizeof(Triangle) * 12);
-        scene.triangles[0] = t1; scene.triangles[1] = t2;
-        scene.triangles[2] = t3; scene.triangles[3] = t4;
-        scene.triangles[4] = t5; scene.triangles[5] = t6;
-        scene.triangles[6] = t7; scene.triangles[7] = t8;
-        scene.triangles[8] = t9; scene.triangles[9] = t10;
-        scene.triangles[10] = l1; scene.triangles[11] = l2;
-        scene.tri_count = 12;
+        TriangleMesh* box = &scene.geometry;
+        add_quad(box, (Vec3){-2,-2,0}, (Vec3){2,-2,0}, (Vec3){2,2,0}, (Vec3){-2,2,0}, (Vec3){0,0,1}, 0);
+        add_quad(box, (Vec3){-2,-2,4}, (Vec3){-2,2,4}, (Vec3){2,2,4}, (Vec3){2,-2,4}, (Vec3){0,0,-1}, 0);
+        add_quad(box, (Vec3){-2,2,0}, (Vec3){2,2,0}, (Vec3){2,2,4}, (Vec3){-2,2,4}, (Vec3){0,-1,0}, 0);
+        add_quad(box, (Vec3){-2,-2,0}, (Vec3){-2,2,0}, (Vec3){-2,2,4}, (Vec3){-2,-2,4}, (Vec3){1,0,0}, 1);
+        add_quad(box, (Vec3){2,-2,0}, (Vec3){2,-2,4}, (Vec3){2,2,4}, (Vec3){2,2,0}, (Vec3){-1,0,0}, 2);
+
+        if (scene_id == 1) {
+            Material metal = { .base_color = {0.9f, 0.8f, 0.5f}, .roughness = 0.2f, .metallic = 1.0f };
+            scene_add_material(&scene, metal);
+            TriangleMesh sphere = make_sphere_mesh(48, 24, 4);
+            int mesh = scene_add_mesh(&scene, &sphere);
+            for (int y = 0; y < 16; y++) {
+                for (int x = 0; x < 16; x++) {
+                    float radius = 0.08f + 0.04f * ((x * 7 + y * 3) % 5) / 4.0f;
+                    Mat3 linear = mat3_mul(mat3_from_axis_angle((Vec3){0, 0, 1}, 0.4f * (x + y)),
+                                           mat3_scale((Vec3){radius, radius, radius * 1.5f}));
+                    Vec3 position = {-1.75f + x * (3.5f / 15.0f), -1.75f + y * (3.5f / 15.0f), radius * 1.5f};
+                    scene_add_instance(&scene, mesh, linear, position);
+                }
+            }
+        }
+
+        if (scene_id == 2) {
+            Material metal = { .base_color = {0.9f, 0.8f, 0.5f}, .roughness = 0.2f, .metallic = 1.0f };
+            scene_add_material(&scene, metal);
+            scene_add_shape(&scene, (Shape){ .type = SHAPE_SPHERE, .position = {-0.8f, 0.6f, 0.8f}, .radius = 0.8f, .material_id = 4 });
+            scene_add_shape(&scene, (Shape){ .type = SHAPE_SPHERE, .position = {0.9f, -0.4f, 0.5f}, .radius = 0.5f, .material_id = 0 });
+            scene_add_shape(&scene, (Shape){ .type = SHAPE_DISK, .position = {0.9f, -0.4f, 0.001f}, .u = {1,0,0}, .v = {0,1,0},
+                                             .radius = 0.8f, .material_id = 1 });
+        }
         
         scene_build(&scene);
+        if (refit_frames > 0) run_refit_frames(&scene, refit_frames);
         camera_init(&camera, (Vec3){0, -8, 2}, (Vec3){0, 0, 2}, (Vec3){0, 0, 1}, 40.0f, (float)options.width/options.height, 0.0f, 10.0f);
     }
     
+    if (bvh_report) {
+        int ray_count = options.width * options.height;
+        Ray* rays = (Ray*)malloc(sizeof(Ray) * ray_count);
+        Sampler sampler;
+        sampler_init(&sampler, 0, 0);
+        for (int y = 0; y < options.height; y++) {
+            for (int x = 0; x < options.width; x++) {
+                float u = (x + 0.5f) / options.width, v = (options.height - y - 0.5f) / options.height;
+                rays[y * options.width + x] = camera_get_ray(&camera, u, v, &sampler);
+            }
+        }
+        scene_bvh_report(&scene, rays, ray_count);
+        free(rays);
+    }
+
     render(&scene, &camera, &options);
+    if (scene.paged.top_nodes) bvh_paged_print_stats(&scene.paged);
     scene_free(&scene);
     return 0;
 }
@@ -25,6 +25,25 @@ Mat3 mat3_transpose(Mat3 m) {
     return res;
 }
 
+Mat3 mat3_inverse(Mat3 m) {
+    Mat3 res;
+    res.m[0][0] = m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1];
+    res.m[0][1] = m.m[0][2] * m.m[2][1] - m.m[0][1] * m.m[2][2];
+    res.m[0][2] = m.m[0][1] * m.m[1][2] - m.m[0][2] * m.m[1][1];
+    res.m[1][0] = m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2];
+    res.m[1][1] = m.m[0][0] * m.m[2][2] - m.m[0][2] * m.m[2][0];
+    res.m[1][2] = m.m[0][2] * m.m[1][0] - m.m[0][0] * m.m[1][2];
+    res.m[2][0] = m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0];
+    res.m[2][1] = m.m[0][1] * m.m[2][0] - m.m[0][0] * m.m[2][1];
+    res.m[2][2] = m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0];
+    float det = m.m[0][0] * res.m[0][0] + m.m[0][1] * res.m[1][0] + m.m[0][2] * res.m[2][0];
+    float inv_det = (fabsf(det) > 1e-12f) ? 1.0f / det : 0.0f;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            res.m[i][j] *= inv_det;
+    return res;
+}
+
 Mat3 mat3_from_axis_angle(Vec3 axis, float angle) {
     float c = cosf(angle), s = sinf(angle), t = 1.0f - c;
     float x = axis.x, y = axis.y, z = axis.z;
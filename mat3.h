@@ -8,9 +8,14 @@ static inline Mat3 mat3_identity() {
     return (Mat3){{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}};
 }
 
+static inline Mat3 mat3_scale(Vec3 s) {
+    return (Mat3){{{s.x, 0, 0}, {0, s.y, 0}, {0, 0, s.z}}};
+}
+
 Vec3 mat3_mul_vec3(Mat3 m, Vec3 v);
 Mat3 mat3_mul(Mat3 a, Mat3 b);
 Mat3 mat3_transpose(Mat3 m);
+Mat3 mat3_inverse(Mat3 m);
 Mat3 mat3_from_axis_angle(Vec3 axis, float angle);
 
 #endif
@@ -0,0 +1,264 @@
+#include "mesh.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MESH_INITIAL_CAPACITY 16
+
+typedef struct {
+    uint32_t code;
+    int index;
+} MortonTri;
+
+void mesh_init(TriangleMesh* mesh, bool with_normals) {
+    memset(mesh, 0, sizeof(TriangleMesh));
+    mesh->vertex_capacity = MESH_INITIAL_CAPACITY;
+    mesh->tri_capacity = MESH_INITIAL_CAPACITY;
+    mesh->positions = (Vec3*)malloc(sizeof(Vec3) * mesh->vertex_capacity);
+    mesh->normals = with_normals ? (Vec3*)malloc(sizeof(Vec3) * mesh->vertex_capacity) : NULL;
+    mesh->indices = (uint32_t*)malloc(sizeof(uint32_t) * 3 * mesh->tri_capacity);
+    mesh->material_ids = (int*)malloc(sizeof(int) * mesh->tri_capacity);
+}
+
+int mesh_add_vertex(TriangleMesh* mesh, Vec3 position, Vec3 normal) {
+    if (mesh->vertex_count == mesh->vertex_capacity) {
+        mesh->vertex_capacity = mesh->vertex_capacity ? 2 * mesh->vertex_capacity : MESH_INITIAL_CAPACITY;
+        mesh->positions = (Vec3*)realloc(mesh->positions, sizeof(Vec3) * mesh->vertex_capacity);
+        if (mesh->normals) mesh->normals = (Vec3*)realloc(mesh->normals, sizeof(Vec3) * mesh->vertex_capacity);
+        if (mesh->packed_normals) mesh->packed_normals = (uint32_t*)realloc(mesh->packed_normals, sizeof(uint32_t) * mesh->vertex_capacity);
+    }
+    mesh->positions[mesh->vertex_count] = position;
+    if (mesh->normals) mesh->normals[mesh->vertex_count] = normal;
+    if (mesh->packed_normals) mesh->packed_normals[mesh->vertex_count] = oct_encode(normal);
+    return mesh->vertex_count++;
+}
+
+void mesh_add_triangle(TriangleMesh* mesh, int a, int b, int c, int material_id) {
+    if (mesh->tri_count == mesh->tri_capacity) {
+        mesh->tri_capacity = mesh->tri_capacity ? 2 * mesh->tri_capacity : MESH_INITIAL_CAPACITY;
+        mesh->indices = (uint32_t*)realloc(mesh->indices, sizeof(uint32_t) * 3 * mesh->tri_capacity);
+        mesh->material_ids = (int*)realloc(mesh->material_ids, sizeof(int) * mesh->tri_capacity);
+    }
+    uint32_t* idx = &mesh->indices[3 * mesh->tri_count];
+    idx[0] = (uint32_t)a;
+    idx[1] = (uint32_t)b;
+    idx[2] = (uint32_t)c;
+    mesh->material_ids[mesh->tri_count++] = material_id;
+}
+
+void mesh_add_quad(TriangleMesh* mesh, int a, int b, int c, int d, int material_id) {
+    if (mesh->quad_count == mesh->quad_capacity) {
+        mesh->quad_capacity = mesh->quad_capacity ? 2 * mesh->quad_capacity : MESH_INITIAL_CAPACITY;
+        mesh->quad_indices = (uint32_t*)realloc(mesh->quad_indices, sizeof(uint32_t) * 4 * mesh->quad_capacity);
+        mesh->quad_material_ids = (int*)realloc(mesh->quad_material_ids, sizeof(int) * mesh->quad_capacity);
+    }
+    uint32_t* idx = &mesh->quad_indices[4 * mesh->quad_count];
+    idx[0] = (uint32_t)a;
+    idx[1] = (uint32_t)b;
+    idx[2] = (uint32_t)c;
+    idx[3] = (uint32_t)d;
+    mesh->quad_material_ids[mesh->quad_count++] = material_id;
+}
+
+static uint32_t expand_bits10(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+static int compare_morton(const void* a, const void* b) {
+    const MortonTri* x = (const MortonTri*)a;
+    const MortonTri* y = (const MortonTri*)b;
+    if (x->code != y->code) return x->code < y->code ? -1 : 1;
+    return x->index - y->index;
+}
+
+static uint32_t quantize_axis(float c, float lo, float extent) {
+    float q = extent > 0.0f ? (c - lo) / extent * 1023.0f : 0.0f;
+    return (uint32_t)fminf(fmaxf(q, 0.0f), 1023.0f);
+}
+
+// Sorts triangles and quads along a Morton curve of their centroids, then
+// renumbers vertices in order of first use so that neighbouring primitives
+// touch neighbouring vertex memory. Unreferenced vertices are dropped.
+void mesh_optimize_layout(TriangleMesh* mesh) {
+    int n = mesh_prim_count(mesh);
+    if (n < 2) return;
+    Vec3* centroids = (Vec3*)malloc(sizeof(Vec3) * n);
+    Vec3 lo = {MAX_FLOAT, MAX_FLOAT, MAX_FLOAT}, hi = {-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT};
+    for (int i = 0; i < n; i++) {
+        Vec3 v[4];
+        int corners = mesh_prim_vertices(mesh, i, v);
+        centroids[i] = v[0];
+        for (int k = 1; k < corners; k++) centroids[i] = vec3_add(centroids[i], v[k]);
+        centroids[i] = vec3_scale(centroids[i], 1.0f / corners);
+        lo = vec3_min(lo, centroids[i]);
+        hi = vec3_max(hi, centroids[i]);
+    }
+    MortonTri* order = (MortonTri*)malloc(sizeof(MortonTri) * n);
+    for (int i = 0; i < n; i++) {
+        uint32_t x = quantize_axis(centroids[i].x, lo.x, hi.x - lo.x);
+        uint32_t y = quantize_axis(centroids[i].y, lo.y, hi.y - lo.y);
+        uint32_t z = quantize_axis(centroids[i].z, lo.z, hi.z - lo.z);
+        order[i] = (MortonTri){(expand_bits10(x) << 2) | (expand_bits10(y) << 1) | expand_bits10(z), i};
+    }
+    free(centroids);
+    qsort(order, n, sizeof(MortonTri), compare_morton);
+
+    uint32_t* indices = (uint32_t*)malloc(sizeof(uint32_t) * 3 * mesh->tri_capacity);
+    int* material_ids = (int*)malloc(sizeof(int) * mesh->tri_capacity);
+    uint32_t* quad_indices = mesh->quad_indices ? (uint32_t*)malloc(sizeof(uint32_t) * 4 * mesh->quad_capacity) : NULL;
+    int* quad_material_ids = mesh->quad_indices ? (int*)malloc(sizeof(int) * mesh->quad_capacity) : NULL;
+    Vec3* positions = (Vec3*)malloc(sizeof(Vec3) * mesh->vertex_capacity);
+    Vec3* normals = mesh->normals ? (Vec3*)malloc(sizeof(Vec3) * mesh->vertex_capacity) : NULL;
+    uint32_t* packed_normals = mesh->packed_normals ? (uint32_t*)malloc(sizeof(uint32_t) * mesh->vertex_capacity) : NULL;
+    int* remap = (int*)malloc(sizeof(int) * (mesh->vertex_count > 0 ? mesh->vertex_count : 1));
+    for (int i = 0; i < mesh->vertex_count; i++) remap[i] = -1;
+    int vertex_count = 0, tri_count = 0, quad_count = 0;
+    for (int i = 0; i < n; i++) {
+        int prim = order[i].index;
+        const uint32_t* old_idx;
+        int corners = mesh_prim_indices(mesh, prim, &old_idx);
+        uint32_t* new_idx = corners == 3 ? &indices[3 * tri_count] : &quad_indices[4 * quad_count];
+        for (int k = 0; k < corners; k++) {
+            uint32_t old = old_idx[k];
+            if (remap[old] < 0) {
+                remap[old] = vertex_count;
+                positions[vertex_count] = mesh->positions[old];
+                if (normals) normals[vertex_count] = mesh->normals[old];
+                if (packed_normals) packed_normals[vertex_count] = mesh->packed_normals[old];
+                vertex_count++;
+            }
+            new_idx[k] = (uint32_t)remap[old];
+        }
+        if (corners == 3) material_ids[tri_count++] = mesh->material_ids[prim];
+        else quad_material_ids[quad_count++] = mesh->quad_material_ids[prim - mesh->tri_count];
+    }
+    free(remap);
+    free(order);
+    free(mesh->indices);
+    free(mesh->material_ids);
+    free(mesh->positions);
+    free(mesh->normals);
+    free(mesh->packed_normals);
+    free(mesh->quad_indices);
+    free(mesh->quad_material_ids);
+    mesh->indices = indices;
+    mesh->material_ids = material_ids;
+    mesh->quad_indices = quad_indices;
+    mesh->quad_material_ids = quad_material_ids;
+    mesh->positions = positions;
+    mesh->normals = normals;
+    mesh->packed_normals = packed_normals;
+    mesh->vertex_count = vertex_count;
+}
+
+static int16_t snorm16(float x) {
+    return (int16_t)lrintf(fminf(fmaxf(x, -1.0f), 1.0f) * 32767.0f);
+}
+
+static float sign_not_zero(float x) { return x >= 0.0f ? 1.0f : -1.0f; }
+
+// Octahedral mapping: project onto the L1 unit sphere, fold the lower
+// hemisphere over the diagonals, and store x/y as 16-bit snorm.
+uint32_t oct_encode(Vec3 n) {
+    float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if (l1 <= 0.0f) return 0;
+    float x = n.x / l1, y = n.y / l1;
+    if (n.z < 0.0f) {
+        float fx = (1.0f - fabsf(y)) * sign_not_zero(x);
+        y = (1.0f - fabsf(x)) * sign_not_zero(y);
+        x = fx;
+    }
+    return (uint16_t)snorm16(x) | ((uint32_t)(uint16_t)snorm16(y) << 16);
+}
+
+Vec3 oct_decode(uint32_t packed) {
+    float x = (int16_t)(packed & 0xFFFF) / 32767.0f;
+    float y = (int16_t)(packed >> 16) / 32767.0f;
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    float t = fmaxf(-z, 0.0f);
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+    return vec3_normalize((Vec3){x, y, z});
+}
+
+// Replaces the float normals by octahedral encodings and reports the angular
+// error against the normalized originals.
+void mesh_compress_normals(TriangleMesh* mesh, float* max_error_degrees, float* mean_error_degrees) {
+    *max_error_degrees = *mean_error_degrees = 0.0f;
+    if (!mesh->normals) return;
+    mesh->packed_normals = (uint32_t*)malloc(sizeof(uint32_t) * mesh->vertex_capacity);
+    double error_sum = 0.0;
+    int measured = 0;
+    for (int i = 0; i < mesh->vertex_count; i++) {
+        Vec3 n = mesh->normals[i];
+        mesh->packed_normals[i] = oct_encode(n);
+        if (vec3_length_sq(n) <= 0.0f) continue;
+        float chord = vec3_length(vec3_sub(vec3_normalize(n), oct_decode(mesh->packed_normals[i])));
+        float error = 2.0f * asinf(fminf(0.5f * chord, 1.0f)) * (180.0f / PI);
+        *max_error_degrees = fmaxf(*max_error_degrees, error);
+        error_sum += error;
+        measured++;
+    }
+    if (measured > 0) *mean_error_degrees = (float)(error_sum / measured);
+    free(mesh->normals);
+    mesh->normals = NULL;
+}
+
+static Vec3 corner_normal(const TriangleMesh* mesh, uint32_t index) {
+    return mesh->normals ? mesh->normals[index] : oct_decode(mesh->packed_normals[index]);
+}
+
+// Quads interpolate their corner normals bilinearly in (s, t); without
+// vertex normals they use the geometric normal of the half that was hit.
+static Vec3 quad_normal(const TriangleMesh* mesh, int quad, float s, float t) {
+    const uint32_t* idx = &mesh->quad_indices[4 * quad];
+    if (mesh->normals || mesh->packed_normals) {
+        Vec3 n01 = vec3_add(vec3_scale(corner_normal(mesh, idx[0]), 1.0f - s), vec3_scale(corner_normal(mesh, idx[1]), s));
+        Vec3 n32 = vec3_add(vec3_scale(corner_normal(mesh, idx[3]), 1.0f - s), vec3_scale(corner_normal(mesh, idx[2]), s));
+        return vec3_add(vec3_scale(n01, 1.0f - t), vec3_scale(n32, t));
+    }
+    Vec3 v0 = mesh->positions[idx[0]], v2 = mesh->positions[idx[2]];
+    Vec3 diagonal = vec3_sub(v2, v0);
+    if (s >= t) return vec3_cross(vec3_sub(mesh->positions[idx[1]], v0), diagonal);
+    return vec3_cross(diagonal, vec3_sub(mesh->positions[idx[3]], v0));
+}
+
+// Interpolated vertex normal, or the geometric normal for meshes without
+// normals. Not normalized.
+Vec3 mesh_normal(const TriangleMesh* mesh, int tri, float u, float v) {
+    if (tri >= mesh->tri_count) return quad_normal(mesh, tri - mesh->tri_count, u, v);
+    const uint32_t* idx = &mesh->indices[3 * tri];
+    if (mesh->normals || mesh->packed_normals) {
+        return vec3_add(vec3_scale(corner_normal(mesh, idx[0]), 1.0f - u - v),
+                        vec3_add(vec3_scale(corner_normal(mesh, idx[1]), u), vec3_scale(corner_normal(mesh, idx[2]), v)));
+    }
+    Vec3 v0, v1, v2;
+    mesh_triangle(mesh, tri, &v0, &v1, &v2);
+    return vec3_cross(vec3_sub(v1, v0), vec3_sub(v2, v0));
+}
+
+size_t mesh_bytes(const TriangleMesh* mesh) {
+    size_t vertex_size = sizeof(Vec3) * (mesh->normals ? 2 : 1) + (mesh->packed_normals ? sizeof(uint32_t) : 0);
+    return vertex_size * mesh->vertex_count + (sizeof(uint32_t) * 3 + sizeof(int)) * mesh->tri_count +
+           (sizeof(uint32_t) * 4 + sizeof(int)) * mesh->quad_count;
+}
+
+// Normals and material ids only: the data read after a hit is found.
+size_t mesh_shading_bytes(const TriangleMesh* mesh) {
+    size_t normal_size = (mesh->normals ? sizeof(Vec3) : 0) + (mesh->packed_normals ? sizeof(uint32_t) : 0);
+    return normal_size * mesh->vertex_count + sizeof(int) * (mesh->tri_count + mesh->quad_count);
+}
+
+void mesh_free(TriangleMesh* mesh) {
+    free(mesh->positions);
+    free(mesh->normals);
+    free(mesh->packed_normals);
+    free(mesh->indices);
+    free(mesh->material_ids);
+    free(mesh->quad_indices);
+    free(mesh->quad_material_ids);
+    memset(mesh, 0, sizeof(TriangleMesh));
+}
@@ -0,0 +1,81 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "types.h"
+#include "vec3.h"
+#include <stddef.h>
+
+// Indexed triangle storage: shared vertex buffers plus three 32-bit vertex
+// indices and a material per triangle. normals is NULL for meshes without
+// vertex normals, which then shade with the geometric normal. After
+// mesh_compress_normals the normals live in packed_normals instead, as
+// 32-bit octahedral encodings (two 16-bit snorm coordinates).
+//
+// Quads are kept as four indices rather than two triangles. Primitive ids
+// number the triangles first and the quads after them, so quad q is
+// primitive tri_count + q. A quad is the two triangles (v0, v1, v2) and
+// (v0, v2, v3), parameterized by (s, t) over the unit square with the shared
+// diagonal at s == t.
+typedef struct {
+    Vec3* positions;
+    Vec3* normals;
+    uint32_t* packed_normals;
+    uint32_t* indices;
+    int* material_ids;
+    uint32_t* quad_indices;
+    int* quad_material_ids;
+    int vertex_count;
+    int tri_count;
+    int quad_count;
+    int vertex_capacity;
+    int tri_capacity;
+    int quad_capacity;
+} TriangleMesh;
+
+void mesh_init(TriangleMesh* mesh, bool with_normals);
+int mesh_add_vertex(TriangleMesh* mesh, Vec3 position, Vec3 normal);
+void mesh_add_triangle(TriangleMesh* mesh, int a, int b, int c, int material_id);
+void mesh_add_quad(TriangleMesh* mesh, int a, int b, int c, int d, int material_id);
+void mesh_optimize_layout(TriangleMesh* mesh);
+void mesh_compress_normals(TriangleMesh* mesh, float* max_error_degrees, float* mean_error_degrees);
+Vec3 mesh_normal(const TriangleMesh* mesh, int tri, float u, float v);
+size_t mesh_bytes(const TriangleMesh* mesh);
+size_t mesh_shading_bytes(const TriangleMesh* mesh);
+void mesh_free(TriangleMesh* mesh);
+
+uint32_t oct_encode(Vec3 n);
+Vec3 oct_decode(uint32_t packed);
+
+static inline void mesh_triangle(const TriangleMesh* mesh, int tri, Vec3* v0, Vec3* v1, Vec3* v2) {
+    const uint32_t* idx = &mesh->indices[3 * tri];
+    *v0 = mesh->positions[idx[0]];
+    *v1 = mesh->positions[idx[1]];
+    *v2 = mesh->positions[idx[2]];
+}
+
+static inline int mesh_prim_count(const TriangleMesh* mesh) {
+    return mesh->tri_count + mesh->quad_count;
+}
+
+// Corner indices of a triangle or quad primitive; returns the corner count.
+static inline int mesh_prim_indices(const TriangleMesh* mesh, int prim, const uint32_t** idx) {
+    if (prim < mesh->tri_count) {
+        *idx = &mesh->indices[3 * prim];
+        return 3;
+    }
+    *idx = &mesh->quad_indices[4 * (prim - mesh->tri_count)];
+    return 4;
+}
+
+static inline int mesh_prim_vertices(const TriangleMesh* mesh, int prim, Vec3 v[4]) {
+    const uint32_t* idx;
+    int n = mesh_prim_indices(mesh, prim, &idx);
+    for (int i = 0; i < n; i++) v[i] = mesh->positions[idx[i]];
+    return n;
+}
+
+static inline int mesh_material(const TriangleMesh* mesh, int prim) {
+    return prim < mesh->tri_count ? mesh->material_ids[prim] : mesh->quad_material_ids[prim - mesh->tri_count];
+}
+
+#endif
@@ -0,0 +1,45 @@
+#include "parallel.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef struct {
+    ParallelForFn fn;
+    void* ctx;
+    int thread;
+    int begin, end;
+    bool started;
+} ParallelTask;
+
+static void* parallel_task(void* arg) {
+    ParallelTask* task = (ParallelTask*)arg;
+    task->fn(task->ctx, task->thread, task->begin, task->end);
+    return NULL;
+}
+
+void parallel_for(int count, int num_threads, int min_chunk, ParallelForFn fn, void* ctx) {
+    if (count <= 0) return;
+    if (min_chunk < 1) min_chunk = 1;
+    int max_threads = (count + min_chunk - 1) / min_chunk;
+    if (num_threads > max_threads) num_threads = max_threads;
+    if (num_threads <= 1) {
+        fn(ctx, 0, 0, count);
+        return;
+    }
+
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    ParallelTask* tasks = (ParallelTask*)malloc(sizeof(ParallelTask) * num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        tasks[i] = (ParallelTask){fn, ctx, i, (int)((long long)count * i / num_threads),
+                                  (int)((long long)count * (i + 1) / num_threads), false};
+        // A range whose thread cannot be created runs inline instead.
+        if (i > 0) tasks[i].started = pthread_create(&threads[i], NULL, parallel_task, &tasks[i]) == 0;
+        if (i > 0 && !tasks[i].started) parallel_task(&tasks[i]);
+    }
+    parallel_task(&tasks[0]);
+    for (int i = 1; i < num_threads; i++) {
+        if (tasks[i].started) pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(tasks);
+}
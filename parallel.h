@@ -0,0 +1,8 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+typedef void (*ParallelForFn)(void* ctx, int thread, int begin, int end);
+
+void parallel_for(int count, int num_threads, int min_chunk, ParallelForFn fn, void* ctx);
+
+#endif
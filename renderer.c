@@ -1,132 +1,799 @@
 #include "renderer.h"
+#include "parallel.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
 #include <stdatomic.h>
+#include <time.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-static Vec3 trace(const Scene* scene, Ray r, int depth, int max_depth, Sampler* sampler) {
-    if (depth >= max_depth) return (Vec3){0};
-
-    float t, u, v;
-    int tri_index;
-    
-    if (!bvh_intersect(&scene->bvh, r, 0.001f, MAX_FLOAT, &t, &tri_index, &u, &v)) {
-        return (Vec3){0.05f, 0.05f, 0.05f}; 
+// One bounce at a surface hit, shared by both integrators. Misses and
+// emitters add their radiance to L and end the path. Otherwise the light
+// sample is returned unoccluded in direct (shadow_dist > 0 when there is
+// one), and r and throughput advance to the next bounce unless the BSDF
+// sample or Russian roulette after the fourth bounce ends the path.
+static bool scatter(const Scene* scene, Ray* r, const Hit* hit, int depth, Sampler* sampler, Vec3* throughput, Vec3* L,
+                    Ray* shadow, float* shadow_dist, Vec3* direct) {
+    *shadow_dist = 0.0f;
+    if (hit->tri_index < 0 && hit->shape_id < 0) {
+        *L = vec3_add(*L, vec3_scale(*throughput, 0.05f));
+        return false;
     }
 
-    Triangle tri = scene->triangles[tri_index];
-    Material mat = scene->materials[tri.material_id];
-    
-    Vec3 n = vec3_normalize(vec3_add(vec3_scale(tri.n0, 1.0f - u - v), vec3_add(vec3_scale(tri.n1, u), vec3_scale(tri.n2, v))));
-    Vec3 p = ray_at(r, t);
-    
-    Vec3 emission = mat.emission;
-    if (vec3_length_sq(emission) > 0.0f) {
-        if (depth == 0) return emission;
-        return emission; 
+    const Material* mat = scene_hit_material(scene, hit);
+    if (vec3_length_sq(mat->emission) > 0.0f) {
+        *L = vec3_add(*L, vec3_mul(*throughput, mat->emission));
+        return false;
     }
 
+    Vec3 n = scene_hit_normal(scene, hit);
+    Vec3 p = ray_at(*r, hit->t);
     Vec3 s, t_vec;
     vec3_coordinate_system(n, &s, &t_vec);
-    Vec3 wo = vec3_scale(r.direction, -1.0f);
+    Vec3 wo = vec3_scale(r->direction, -1.0f);
 
-    Vec3 Ld = {0};
     if (scene->light_count > 0) {
         int light_idx = (int)(sampler_next_1d(sampler) * scene->light_count);
         if (light_idx >= scene->light_count) light_idx = scene->light_count - 1;
         const Light* light = &scene->lights[light_idx];
-        
+
         Vec3 wi_light;
         float pdf_light, dist_light;
         Vec3 Li = light_sample(light, p, sampler, &wi_light, &pdf_light, &dist_light);
-        
+
         if (pdf_light > 0.0f && vec3_length_sq(Li) > 0.0f) {
-            Ray shadow_ray = { .origin = p, .direction = wi_light };
-            float t_shadow, u_s, v_s;
-            int tri_shadow;
-            if (!bvh_intersect(&scene->bvh, shadow_ray, 0.001f, dist_light - 0.001f, &t_shadow, &tri_shadow, &u_s, &v_s)) {
-                Vec3 f = material_eval(&mat, wo, wi_light, n, s, t_vec);
-                Ld = vec3_add(Ld, vec3_scale(vec3_mul(f, Li), 1.0f / pdf_light));
-            }
+            Vec3 f = material_eval(mat, wo, wi_light, n, s, t_vec);
+            float weight = (float)scene->light_count / pdf_light;
+            *shadow = (Ray){ .origin = p, .direction = wi_light };
+            *shadow_dist = fmaxf(dist_light - 0.001f, FLT_MIN);
+            *direct = vec3_mul(*throughput, vec3_scale(vec3_mul(f, Li), weight));
         }
-        Ld = vec3_scale(Ld, (float)scene->light_count);
     }
 
     Vec3 wi;
     float pdf;
-    Vec3 f = material_sample(&mat, wo, &wi, n, s, t_vec, sampler, &pdf);
-    
-    if (pdf > 0.0f && vec3_length_sq(f) > 0.0f) {
-        float max_comp = fmaxf(f.x, fmaxf(f.y, f.z));
-        if (depth > 3) {
-            float q = fmaxf(0.05f, 1.0f - max_comp);
-            if (sampler_next_1d(sampler) < q) return Ld;
-            f = vec3_scale(f, 1.0f / (1.0f - q));
-        }
-        
-        Ray next_ray = { .origin = p, .direction = wi };
-        Vec3 Li = trace(scene, next_ray, depth + 1, max_depth, sampler);
-        return vec3_add(Ld, vec3_mul(f, vec3_scale(Li, 1.0f / pdf)));
+    Vec3 f = material_sample(mat, wo, &wi, n, s, t_vec, sampler, &pdf);
+    if (!(pdf > 0.0f) || vec3_length_sq(f) == 0.0f) return false;
+    *throughput = vec3_mul(*throughput, vec3_scale(f, 1.0f / pdf));
+
+    if (depth > 3) {
+        float q = fmaxf(0.05f, 1.0f - fmaxf(throughput->x, fmaxf(throughput->y, throughput->z)));
+        if (sampler_next_1d(sampler) < q) return false;
+        *throughput = vec3_scale(*throughput, 1.0f / (1.0f - q));
+    }
+    *r = (Ray){ .origin = p, .direction = wi };
+    return true;
+}
+
+// Iterative path loop: the primary hit comes from the packet traversal,
+// later bounces are traced here.
+static Vec3 trace_path(const Scene* scene, Ray r, Hit hit, int max_depth, Sampler* sampler) {
+    Vec3 L = {0};
+    Vec3 throughput = {1.0f, 1.0f, 1.0f};
+
+    for (int depth = 0; depth < max_depth; depth++) {
+        if (depth > 0) scene_intersect(scene, r, 0.001f, MAX_FLOAT, &hit);
+        Ray shadow;
+        float shadow_dist;
+        Vec3 direct;
+        bool alive = scatter(scene, &r, &hit, depth, sampler, &throughput, &L, &shadow, &shadow_dist, &direct);
+        if (shadow_dist > 0.0f && !scene_occluded(scene, shadow, 0.001f, shadow_dist)) L = vec3_add(L, direct);
+        if (!alive) break;
     }
-    return Ld;
+    return L;
 }
 
+// The buffer holds radiance sums with per-pixel sample counts and luminance
+// squares for the adaptive variance estimate. A tile's lock guards its
+// pixels, so work items over the same tile never race and snapshots see
+// whole items. Progress is counted in pixel samples.
+typedef struct {
+    float* sum;
+    float* lum_sq;
+    int* samples;
+    pthread_mutex_t* tile_locks;
+    float* tile_cost;
+    int tile_size, tiles_x, tiles_y;
+    long long completed;
+    long long total;
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+} Accumulator;
+
+typedef struct {
+    Vec3 color;
+    float lum_sq;
+    int samples;
+} PixelSum;
+
+// A work item is a band of rows of a tile over a range of its samples.
+// Items can be split on demand along either range.
+typedef struct {
+    int tile;
+    int y0, y1;
+    int first_sample, sample_count;
+} TileItem;
+
+// Owners take items from the head of their deque; thieves and split halves
+// use the tail.
+typedef struct {
+    TileItem* items;
+    int head, tail, capacity;
+    pthread_mutex_t lock;
+} WorkDeque;
+
+// outstanding counts items queued or being rendered; a split is queued
+// before its parent finishes, so the count only reaches zero once the phase
+// is over. Idle threads sleep on wake until an item is queued or the count
+// reaches zero; generation counts the queued items under lock.
+typedef struct {
+    WorkDeque* deques;
+    int deque_count;
+    atomic_int outstanding;
+    int generation;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    atomic_int idle;
+    atomic_int steals;
+    atomic_int splits;
+} Scheduler;
+
 typedef struct {
     int id;
     const Scene* scene;
     const Camera* camera;
     const RenderOptions* options;
-    float* buffer;
-    atomic_int* tile_index;
-    int tiles_x, tiles_y;
+    Accumulator* acc;
+    Scheduler* sched;
+    Sampler sampler;
+    double finished;
 } ThreadData;
 
 #define TILE_SIZE 32
 
-void* render_thread(void* arg) {
-    ThreadData* data = (ThreadData*)arg;
+static float luminance(Vec3 c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+static void pixel_stats(const PixelSum* a, const PixelSum* b, int* count, float* mean, float* var) {
+    *count = a->samples + b->samples;
+    *mean = *count > 0 ? (luminance(a->color) + luminance(b->color)) / *count : 0.0f;
+    *var = *count > 1 ? fmaxf(0.0f, ((a->lum_sq + b->lum_sq) / *count - *mean * *mean) * *count / (*count - 1)) : 0.0f;
+}
+
+// Per-sample luminance variance of a whole tile relative to its squared
+// mean, from the earlier items.
+static float tile_relative_variance(const PixelSum* prior, int tile_w, int tile_h) {
+    static const PixelSum none = {{0}, 0.0f, 0};
+    float mean_sum = 0.0f, var_sum = 0.0f;
+    int n = 0;
+    for (int y = 0; y < tile_h; y++) {
+        for (int x = 0; x < tile_w; x++) {
+            int count;
+            float mean, var;
+            pixel_stats(&prior[y * TILE_SIZE + x], &none, &count, &mean, &var);
+            if (count < 2) continue;
+            mean_sum += mean;
+            var_sum += var;
+            n++;
+        }
+    }
+    return n > 0 && mean_sum > 0.0f ? var_sum * n / (mean_sum * mean_sum) : 0.0f;
+}
+
+// A block is converged once the standard error of its pixels' mean
+// luminance, pooled over the block, is below the threshold relative to the
+// block's mean. Rare bright paths are easily missed by a block's few
+// samples, and stopping on such a lucky streak darkens the image, so the
+// block's error is never taken below what the tile's relative variance
+// predicts for its sample count. Totals are the earlier passes plus the
+// samples taken in this one.
+static bool block_converged(const PixelSum* prior, const PixelSum* current, const int* pixels, int n,
+                            float tile_rel_var, float threshold) {
+    float mean_sum = 0.0f, var_sum = 0.0f;
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        float mean, var;
+        pixel_stats(&prior[pixels[i]], &current[pixels[i]], &count, &mean, &var);
+        if (count < 2) return false;
+        mean_sum += mean;
+        var_sum += var / count;
+    }
+    float mean = fmaxf(mean_sum / n, 1e-3f);
+    float err_sq = fmaxf(var_sum / n, tile_rel_var * mean * mean / count);
+    return err_sq <= threshold * threshold * mean * mean;
+}
+
+static double seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void deque_push(Scheduler* sched, WorkDeque* d, TileItem item) {
+    // Count the item before it becomes visible, so a thief that takes and
+    // finishes it cannot drop outstanding to zero while this one is pending.
+    atomic_fetch_add(&sched->outstanding, 1);
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->capacity) {
+        d->capacity = d->capacity ? 2 * d->capacity : 64;
+        d->items = (TileItem*)realloc(d->items, sizeof(TileItem) * d->capacity);
+    }
+    d->items[d->tail++] = item;
+    pthread_mutex_unlock(&d->lock);
+    pthread_mutex_lock(&sched->lock);
+    sched->generation++;
+    pthread_cond_signal(&sched->wake);
+    pthread_mutex_unlock(&sched->lock);
+}
+
+static bool deque_take(WorkDeque* d, bool steal, TileItem* item) {
+    pthread_mutex_lock(&d->lock);
+    bool found = d->head < d->tail;
+    if (found) *item = steal ? d->items[--d->tail] : d->items[d->head++];
+    if (d->head == d->tail) d->head = d->tail = 0;
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static bool next_item(Scheduler* sched, int id, TileItem* item) {
+    if (deque_take(&sched->deques[id], false, item)) return true;
+    for (int k = 1; k < sched->deque_count; k++) {
+        if (deque_take(&sched->deques[(id + k) % sched->deque_count], true, item)) {
+            atomic_fetch_add(&sched->steals, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void finish_item(Scheduler* sched) {
+    if (atomic_fetch_sub(&sched->outstanding, 1) > 1) return;
+    pthread_mutex_lock(&sched->lock);
+    pthread_cond_broadcast(&sched->wake);
+    pthread_mutex_unlock(&sched->lock);
+}
+
+static void render_item(ThreadData* data, TileItem item, PixelSum* tile_sum, PixelSum* tile_prior) {
+    Accumulator* acc = data->acc;
+    Scheduler* sched = data->sched;
+    WorkDeque* own = &sched->deques[data->id];
+    Sampler* sampler = &data->sampler;
     int width = data->options->width;
     int height = data->options->height;
-    int total_tiles = data->tiles_x * data->tiles_y;
-    
-    Sampler sampler;
-    sampler_init(&sampler, data->id * 123456789ULL, data->id);
+    float threshold = data->options->adaptive_threshold;
+    int min_spp = data->options->min_spp;
+    int packet = data->options->packet_size;
+    int block_w = packet >= 8 ? 4 : (packet >= 4 ? 2 : 1);
+    int block_h = packet >= 16 ? 4 : (packet >= 4 ? 2 : 1);
+    double start = seconds();
+
+    for (int idle = atomic_load(&sched->idle); idle > 0 && item.sample_count >= 2; idle--) {
+        int half = item.sample_count / 2;
+        item.sample_count -= half;
+        deque_push(sched, own, (TileItem){item.tile, item.y0, item.y1, item.first_sample + item.sample_count, half});
+        atomic_fetch_add(&sched->splits, 1);
+    }
+
+    int x_start = item.tile % acc->tiles_x * acc->tile_size;
+    int y_tile = item.tile / acc->tiles_x * acc->tile_size;
+    int x_end = (x_start + acc->tile_size < width) ? x_start + acc->tile_size : width;
+    int y_tile_end = (y_tile + acc->tile_size < height) ? y_tile + acc->tile_size : height;
+    int y_start = y_tile + item.y0;
+    int y_end = y_tile + item.y1 < y_tile_end ? y_tile + item.y1 : y_tile_end;
+
+    float tile_rel_var = 0.0f;
+    if (threshold > 0.0f) {
+        pthread_mutex_lock(&acc->tile_locks[item.tile]);
+        for (int y = y_tile; y < y_tile_end; y++) {
+            for (int x = x_start; x < x_end; x++) {
+                int idx = y * width + x;
+                tile_prior[(y - y_tile) * TILE_SIZE + (x - x_start)] = (PixelSum){
+                    {acc->sum[idx * 3 + 0], acc->sum[idx * 3 + 1], acc->sum[idx * 3 + 2]}, acc->lum_sq[idx], acc->samples[idx]};
+            }
+        }
+        pthread_mutex_unlock(&acc->tile_locks[item.tile]);
+        tile_rel_var = tile_relative_variance(tile_prior, x_end - x_start, y_tile_end - y_tile);
+    }
+
+    for (int by = y_start; by < y_end; by += block_h) {
+        if (y_end - by >= 2 * block_h && atomic_load(&sched->idle) > 0) {
+            int mid = by + (y_end - by) / (2 * block_h) * block_h;
+            deque_push(sched, own, (TileItem){item.tile, mid - y_tile, y_end - y_tile, item.first_sample, item.sample_count});
+            atomic_fetch_add(&sched->splits, 1);
+            y_end = mid;
+        }
+        for (int bx = x_start; bx < x_end; bx += block_w) {
+            int bx_end = (bx + block_w < x_end) ? bx + block_w : x_end;
+            int by_end = (by + block_h < y_end) ? by + block_h : y_end;
+            int pixels[BVH_MAX_PACKET];
+            int n = 0;
+            for (int y = by; y < by_end; y++) {
+                for (int x = bx; x < bx_end; x++) {
+                    pixels[n] = (y - y_tile) * TILE_SIZE + (x - x_start);
+                    tile_sum[pixels[n++]] = (PixelSum){{0}, 0.0f, 0};
+                }
+            }
+            int taken = threshold > 0.0f ? tile_prior[pixels[0]].samples : 0;
+
+            for (int s = 0; s < item.sample_count; s++) {
+                if (threshold > 0.0f && taken >= min_spp && block_converged(tile_prior, tile_sum, pixels, n, tile_rel_var, threshold)) break;
+                Ray rays[BVH_MAX_PACKET];
+                for (int i = 0; i < n; i++) {
+                    float u = (float)(x_start + pixels[i] % TILE_SIZE) + sampler_next_1d(sampler);
+                    float v = (float)(y_tile + pixels[i] / TILE_SIZE) + sampler_next_1d(sampler);
+                    rays[i] = camera_get_ray(data->camera, u / width, (height - v) / height, sampler);
+                }
+
+                Hit hits[BVH_MAX_PACKET];
+                scene_intersect_packet(data->scene, rays, n, 0.001f, MAX_FLOAT, hits);
+                for (int i = 0; i < n; i++) {
+                    Vec3 L = trace_path(data->scene, rays[i], hits[i], data->options->max_bounces, sampler);
+                    PixelSum* sum = &tile_sum[pixels[i]];
+                    float lum = luminance(L);
+                    sum->color = vec3_add(sum->color, L);
+                    sum->lum_sq += lum * lum;
+                    sum->samples++;
+                }
+                taken++;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&acc->tile_locks[item.tile]);
+    for (int y = y_start; y < y_end; y++) {
+        for (int x = x_start; x < x_end; x++) {
+            const PixelSum* sum = &tile_sum[(y - y_tile) * TILE_SIZE + (x - x_start)];
+            int idx = y * width + x;
+            acc->sum[idx * 3 + 0] += sum->color.x;
+            acc->sum[idx * 3 + 1] += sum->color.y;
+            acc->sum[idx * 3 + 2] += sum->color.z;
+            acc->lum_sq[idx] += sum->lum_sq;
+            acc->samples[idx] += sum->samples;
+        }
+    }
+    acc->tile_cost[item.tile] += (float)(seconds() - start);
+    pthread_mutex_unlock(&acc->tile_locks[item.tile]);
+
+    pthread_mutex_lock(&acc->lock);
+    acc->completed += (long long)(x_end - x_start) * (y_end - y_start) * item.sample_count;
+    pthread_cond_signal(&acc->progress);
+    pthread_mutex_unlock(&acc->lock);
+}
+
+void* render_thread(void* arg) {
+    ThreadData* data = (ThreadData*)arg;
+    Scheduler* sched = data->sched;
+    PixelSum* tile_sum = (PixelSum*)malloc(sizeof(PixelSum) * TILE_SIZE * TILE_SIZE);
+    PixelSum* tile_prior = (PixelSum*)calloc(TILE_SIZE * TILE_SIZE, sizeof(PixelSum));
+    bool waiting = false;
 
     while (1) {
-        int tile = atomic_fetch_add(data->tile_index, 1);
-        if (tile >= total_tiles) break;
-        
-        int tx = tile % data->tiles_x;
-        int ty = tile / data->tiles_x;
-        
-        int x_start = tx * TILE_SIZE;
-        int y_start = ty * TILE_SIZE;
-        int x_end = (x_start + TILE_SIZE < width) ? x_start + TILE_SIZE : width;
-        int y_end = (y_start + TILE_SIZE < height) ? y_start + TILE_SIZE : height;
-        
+        TileItem item;
+        pthread_mutex_lock(&sched->lock);
+        int generation = sched->generation;
+        pthread_mutex_unlock(&sched->lock);
+        if (next_item(sched, data->id, &item)) {
+            if (waiting) atomic_fetch_sub(&sched->idle, 1);
+            waiting = false;
+            render_item(data, item, tile_sum, tile_prior);
+            finish_item(sched);
+            continue;
+        }
+        if (!waiting) atomic_fetch_add(&sched->idle, 1);
+        waiting = true;
+        pthread_mutex_lock(&sched->lock);
+        while (sched->generation == generation && atomic_load(&sched->outstanding) > 0) pthread_cond_wait(&sched->wake, &sched->lock);
+        pthread_mutex_unlock(&sched->lock);
+        if (atomic_load(&sched->outstanding) == 0) break;
+    }
+    if (waiting) atomic_fetch_sub(&sched->idle, 1);
+    data->finished = seconds();
+    free(tile_sum);
+    free(tile_prior);
+    return NULL;
+}
+
+// Wavefront integrator: a wave of paths lives in SoA arrays indexed by path
+// slot, and each bounce runs as bulk stages over the whole wave. Paths are
+// seeded per sample, so the image does not depend on the thread count.
+#define WAVEFRONT_PATHS (1 << 17)
+
+typedef struct {
+    const Scene* scene;
+    const Camera* camera;
+    const RenderOptions* options;
+    float* buffer;
+    long long first_sample;
+    int depth;
+
+    Ray* ray;
+    Vec3* throughput;
+    Vec3* radiance;
+    Sampler* sampler;
+    int* pixel;
+    bool* alive;
+
+    int* active;
+    int active_count;
+    Ray* extend_rays;
+    Hit* hits;
+    int* material;
+    int* order;
+    int* material_start;
+
+    Ray* shadow_rays;
+    float* shadow_dist;
+    Vec3* shadow_radiance;
+    int* shadow_slot;
+    bool* shadow_blocked;
+    atomic_int shadow_count;
+} Wavefront;
+
+static void wavefront_generate(void* ctx, int thread, int begin, int end) {
+    (void)thread;
+    Wavefront* wf = (Wavefront*)ctx;
+    int width = wf->options->width, height = wf->options->height;
+    for (int i = begin; i < end; i++) {
+        long long sample = wf->first_sample + i;
+        int pixel = (int)(sample % ((long long)width * height));
+        sampler_init(&wf->sampler[i], 0x853c49e6748fea9bULL, (uint64_t)sample);
+        float u = (float)(pixel % width) + sampler_next_1d(&wf->sampler[i]);
+        float v = (float)(pixel / width) + sampler_next_1d(&wf->sampler[i]);
+        wf->ray[i] = camera_get_ray(wf->camera, u / width, (height - v) / height, &wf->sampler[i]);
+        wf->throughput[i] = (Vec3){1.0f, 1.0f, 1.0f};
+        wf->radiance[i] = (Vec3){0};
+        wf->pixel[i] = pixel;
+        wf->active[i] = i;
+    }
+}
+
+static void wavefront_extend(void* ctx, int thread, int begin, int end) {
+    (void)thread;
+    Wavefront* wf = (Wavefront*)ctx;
+    for (int k = begin; k < end; k++) wf->extend_rays[k] = wf->ray[wf->active[k]];
+    scene_intersect_stream(wf->scene, wf->extend_rays + begin, end - begin, 0.001f, MAX_FLOAT, wf->hits + begin);
+}
+
+// Counting sort of the extend queue by material, misses last, so that the
+// shade stage runs over runs of the same material.
+static void wavefront_sort(Wavefront* wf) {
+    const Scene* scene = wf->scene;
+    int* start = wf->material_start;
+    memset(start, 0, sizeof(int) * (scene->material_count + 2));
+    for (int k = 0; k < wf->active_count; k++) {
+        const Hit* hit = &wf->hits[k];
+        int key = hit->tri_index < 0 && hit->shape_id < 0 ? scene->material_count : (int)(scene_hit_material(scene, hit) - scene->materials);
+        wf->material[k] = key;
+        start[key + 1]++;
+    }
+    for (int m = 0; m <= scene->material_count; m++) start[m + 1] += start[m];
+    for (int k = 0; k < wf->active_count; k++) wf->order[start[wf->material[k]]++] = k;
+}
+
+static void wavefront_shade(void* ctx, int thread, int begin, int end) {
+    (void)thread;
+    Wavefront* wf = (Wavefront*)ctx;
+    for (int o = begin; o < end; o++) {
+        int k = wf->order[o];
+        int i = wf->active[k];
+        Ray shadow;
+        float shadow_dist;
+        Vec3 direct;
+        wf->alive[i] = scatter(wf->scene, &wf->ray[i], &wf->hits[k], wf->depth, &wf->sampler[i], &wf->throughput[i],
+                               &wf->radiance[i], &shadow, &shadow_dist, &direct);
+        if (shadow_dist > 0.0f) {
+            int q = atomic_fetch_add(&wf->shadow_count, 1);
+            wf->shadow_rays[q] = shadow;
+            wf->shadow_dist[q] = shadow_dist;
+            wf->shadow_radiance[q] = direct;
+            wf->shadow_slot[q] = i;
+        }
+    }
+}
+
+// Each path has at most one shadow ray per bounce, so the radiance updates
+// do not race.
+static void wavefront_connect(void* ctx, int thread, int begin, int end) {
+    (void)thread;
+    Wavefront* wf = (Wavefront*)ctx;
+    scene_occluded_stream(wf->scene, wf->shadow_rays + begin, end - begin, 0.001f, wf->shadow_dist + begin, wf->shadow_blocked + begin);
+    for (int q = begin; q < end; q++) {
+        if (wf->shadow_blocked[q]) continue;
+        int i = wf->shadow_slot[q];
+        wf->radiance[i] = vec3_add(wf->radiance[i], wf->shadow_radiance[q]);
+    }
+}
+
+// A wave never holds more than one sample of a pixel.
+static void wavefront_accumulate(void* ctx, int thread, int begin, int end) {
+    (void)thread;
+    Wavefront* wf = (Wavefront*)ctx;
+    float scale = 1.0f / wf->options->samples_per_pixel;
+    for (int i = begin; i < end; i++) {
+        float* dst = &wf->buffer[wf->pixel[i] * 3];
+        dst[0] += wf->radiance[i].x * scale;
+        dst[1] += wf->radiance[i].y * scale;
+        dst[2] += wf->radiance[i].z * scale;
+    }
+}
+
+static void render_wavefront(const Scene* scene, const Camera* camera, const RenderOptions* options, float* buffer) {
+    long long pixels = (long long)options->width * options->height;
+    long long total = pixels * options->samples_per_pixel;
+    int capacity = (int)(pixels < WAVEFRONT_PATHS ? pixels : WAVEFRONT_PATHS);
+    int threads = options->num_threads;
+    Wavefront wf = {
+        .scene = scene,
+        .camera = camera,
+        .options = options,
+        .buffer = buffer,
+        .ray = (Ray*)malloc(sizeof(Ray) * capacity),
+        .throughput = (Vec3*)malloc(sizeof(Vec3) * capacity),
+        .radiance = (Vec3*)malloc(sizeof(Vec3) * capacity),
+        .sampler = (Sampler*)malloc(sizeof(Sampler) * capacity),
+        .pixel = (int*)malloc(sizeof(int) * capacity),
+        .alive = (bool*)malloc(sizeof(bool) * capacity),
+        .active = (int*)malloc(sizeof(int) * capacity),
+        .extend_rays = (Ray*)malloc(sizeof(Ray) * capacity),
+        .hits = (Hit*)malloc(sizeof(Hit) * capacity),
+        .material = (int*)malloc(sizeof(int) * capacity),
+        .order = (int*)malloc(sizeof(int) * capacity),
+        .material_start = (int*)malloc(sizeof(int) * (scene->material_count + 2)),
+        .shadow_rays = (Ray*)malloc(sizeof(Ray) * capacity),
+        .shadow_dist = (float*)malloc(sizeof(float) * capacity),
+        .shadow_radiance = (Vec3*)malloc(sizeof(Vec3) * capacity),
+        .shadow_slot = (int*)malloc(sizeof(int) * capacity),
+        .shadow_blocked = (bool*)malloc(sizeof(bool) * capacity)
+    };
+
+    for (wf.first_sample = 0; wf.first_sample < total; wf.first_sample += capacity) {
+        int count = (int)(total - wf.first_sample < capacity ? total - wf.first_sample : capacity);
+        parallel_for(count, threads, 1024, wavefront_generate, &wf);
+        wf.active_count = count;
+        for (wf.depth = 0; wf.depth < options->max_bounces && wf.active_count > 0; wf.depth++) {
+            parallel_for(wf.active_count, threads, 256, wavefront_extend, &wf);
+            wavefront_sort(&wf);
+            atomic_store(&wf.shadow_count, 0);
+            parallel_for(wf.active_count, threads, 256, wavefront_shade, &wf);
+            parallel_for(atomic_load(&wf.shadow_count), threads, 256, wavefront_connect, &wf);
+            int alive = 0;
+            for (int k = 0; k < wf.active_count; k++) {
+                if (wf.alive[wf.active[k]]) wf.active[alive++] = wf.active[k];
+            }
+            wf.active_count = alive;
+        }
+        parallel_for(count, threads, 1024, wavefront_accumulate, &wf);
+    }
+
+    free(wf.ray);
+    free(wf.throughput);
+    free(wf.radiance);
+    free(wf.sampler);
+    free(wf.pixel);
+    free(wf.alive);
+    free(wf.active);
+    free(wf.extend_rays);
+    free(wf.hits);
+    free(wf.material);
+    free(wf.order);
+    free(wf.material_start);
+    free(wf.shadow_rays);
+    free(wf.shadow_dist);
+    free(wf.shadow_radiance);
+    free(wf.shadow_slot);
+    free(wf.shadow_blocked);
+}
+
+// Divides each pixel's sums by its sample count, under the tile lock so
+// that a snapshot never mixes a half-added item into the image.
+static void resolve_image(Accumulator* acc, int width, int height, float* image) {
+    for (int tile = 0; tile < acc->tiles_x * acc->tiles_y; tile++) {
+        int x_start = tile % acc->tiles_x * acc->tile_size, y_start = tile / acc->tiles_x * acc->tile_size;
+        int x_end = (x_start + acc->tile_size < width) ? x_start + acc->tile_size : width;
+        int y_end = (y_start + acc->tile_size < height) ? y_start + acc->tile_size : height;
+        pthread_mutex_lock(&acc->tile_locks[tile]);
         for (int y = y_start; y < y_end; y++) {
             for (int x = x_start; x < x_end; x++) {
-                Vec3 color = {0};
-                for (int s = 0; s < data->options->samples_per_pixel; s++) {
-                    float u = (float)x + sampler_next_1d(&sampler);
-                    float v = (float)y + sampler_next_1d(&sampler);
-                    Ray r = camera_get_ray(data->camera, u / width, (height - v) / height, &sampler);
-                    color = vec3_add(color, trace(data->scene, r, 0, data->options->max_bounces, &sampler));
-                }
-                color = vec3_scale(color, 1.0f / data->options->samples_per_pixel);
-                
+                int samples = acc->samples[y * width + x];
+                float scale = samples > 0 ? 1.0f / samples : 0.0f;
                 int idx = (y * width + x) * 3;
-                data->buffer[idx + 0] = color.x;
-                data->buffer[idx + 1] = color.y;
-                data->buffer[idx + 2] = color.z;
+                image[idx + 0] = acc->sum[idx + 0] * scale;
+                image[idx + 1] = acc->sum[idx + 1] * scale;
+                image[idx + 2] = acc->sum[idx + 2] * scale;
             }
         }
+        pthread_mutex_unlock(&acc->tile_locks[tile]);
     }
-    return NULL;
+}
+
+// Files are written under a temporary name and renamed into place, so a
+// reader never sees a partially written snapshot.
+static bool write_image(const float* image, int width, int height, const char* base, bool verbose) {
+    char filename[256], tmp_filename[264];
+    snprintf(filename, sizeof(filename), "%s.hdr", base);
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+    bool ok = stbi_write_hdr(tmp_filename, width, height, 3, image) && rename(tmp_filename, filename) == 0;
+    if (verbose) printf(ok ? "Saved %s\n" : "Error saving HDR\n", filename);
+    if (!ok) return false;
+
+    snprintf(filename, sizeof(filename), "%s.png", base);
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+    unsigned char* png_data = (unsigned char*)malloc(width * height * 3);
+    for (int i = 0; i < width * height * 3; i++) {
+        float val = image[i];
+        val = val / (1.0f + val);
+        val = powf(val, 1.0f / 2.2f);
+        png_data[i] = (unsigned char)(fminf(val, 1.0f) * 255.0f);
+    }
+    ok = stbi_write_png(tmp_filename, width, height, 3, png_data, width * 3) && rename(tmp_filename, filename) == 0;
+    free(png_data);
+    if (verbose) printf(ok ? "Saved %s\n" : "Error saving PNG\n", filename);
+    return ok;
+}
+
+// Waits for finished work items and publishes a snapshot every
+// snapshot_passes passes or snapshot_seconds seconds while the workers keep
+// rendering.
+static void publish_snapshots(Accumulator* acc, const RenderOptions* options, int pass_spp, float* image) {
+    long long pass_samples = (long long)options->width * options->height * pass_spp;
+    int passes = (int)((acc->total + pass_samples - 1) / pass_samples);
+    int last_pass = 0;
+    double start = seconds();
+    double last_time = 0.0;
+
+    pthread_mutex_lock(&acc->lock);
+    while (acc->completed < acc->total) {
+        if (options->snapshot_seconds > 0.0f) {
+            double deadline = start + last_time + options->snapshot_seconds;
+            if (deadline > seconds()) {
+                struct timespec ts = {(time_t)deadline, (long)((deadline - (double)(time_t)deadline) * 1e9)};
+                pthread_cond_timedwait(&acc->progress, &acc->lock, &ts);
+            }
+        } else {
+            pthread_cond_wait(&acc->progress, &acc->lock);
+        }
+        int pass = (int)(acc->completed / pass_samples);
+        double now = seconds() - start;
+        bool due = (options->snapshot_passes > 0 && pass >= last_pass + options->snapshot_passes) ||
+                   (options->snapshot_seconds > 0.0f && now >= last_time + options->snapshot_seconds);
+        if (!due || acc->completed >= acc->total) continue;
+        pthread_mutex_unlock(&acc->lock);
+
+        resolve_image(acc, options->width, options->height, image);
+        if (write_image(image, options->width, options->height, options->output_filename, false)) {
+            printf("Snapshot after %d/%d passes (%.1f s)\n", pass, passes, now);
+            fflush(stdout);
+        }
+        last_pass = pass;
+        last_time = now;
+        pthread_mutex_lock(&acc->lock);
+    }
+    pthread_mutex_unlock(&acc->lock);
+}
+
+typedef struct {
+    float key;
+    int tile;
+} TileKey;
+
+static int compare_tile_keys(const void* a, const void* b) {
+    float x = ((const TileKey*)a)->key, y = ((const TileKey*)b)->key;
+    return (x > y) - (x < y);
+}
+
+static int hilbert_index(int n, int x, int y) {
+    int d = 0;
+    for (int s = n / 2; s > 0; s /= 2) {
+        int rx = (x & s) > 0, ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            int t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+// Runs one scheduling phase on all threads; returns the spread of the
+// threads' finishing times, the time the first idle thread waited.
+static double run_phase(ThreadData* thread_data, int num_threads, const RenderOptions* options, int pass_spp, float* image) {
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    for (int i = 0; i < num_threads; i++) pthread_create(&threads[i], NULL, render_thread, &thread_data[i]);
+    if (image && (options->snapshot_passes > 0 || options->snapshot_seconds > 0.0f)) {
+        publish_snapshots(thread_data[0].acc, options, pass_spp, image);
+    }
+    double first = MAX_FLOAT, last = 0.0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        first = fmin(first, thread_data[i].finished);
+        last = fmax(last, thread_data[i].finished);
+    }
+    free(threads);
+    return last - first;
+}
+
+// Prints the adaptive sample budget and optionally writes the per-pixel
+// sample counts as a grayscale PNG scaled to the maximum spp.
+static void report_samples(const Accumulator* acc, const RenderOptions* options) {
+    int pixels = options->width * options->height;
+    long long total = 0;
+    for (int i = 0; i < pixels; i++) total += acc->samples[i];
+    printf("Adaptive sampling: %.1f average spp, %.1f%% of %d spp\n", (double)total / pixels,
+           100.0 * total / ((double)pixels * options->samples_per_pixel), options->samples_per_pixel);
+    if (!options->spp_map_filename) return;
+    unsigned char* map = (unsigned char*)malloc(options->width * options->height);
+    for (int i = 0; i < pixels; i++) map[i] = (unsigned char)(255.0f * acc->samples[i] / options->samples_per_pixel);
+    if (stbi_write_png(options->spp_map_filename, options->width, options->height, 1, map, options->width)) {
+        printf("Saved %s\n", options->spp_map_filename);
+    }
+    free(map);
+}
+
+// Tiles shrink for small images so that every thread gets several. A pilot
+// phase takes the first sample of every tile in Hilbert order, which also
+// measures each tile's cost; the remaining samples are then queued pass by
+// pass with the most expensive tiles first, dealt round-robin over the
+// per-thread deques. Idle threads steal, and busy threads split their item
+// by samples or rows while others wait.
+static void render_tiles(const Scene* scene, const Camera* camera, const RenderOptions* options, Accumulator* acc, float* image) {
+    int num_threads = options->num_threads > 0 ? options->num_threads : 1;
+    int total_tiles = acc->tiles_x * acc->tiles_y;
+    int spp = options->samples_per_pixel;
+    int pass_spp = options->pass_spp > 0 ? options->pass_spp : spp;
+    Scheduler sched = { .deques = (WorkDeque*)calloc(num_threads, sizeof(WorkDeque)), .deque_count = num_threads };
+    for (int i = 0; i < num_threads; i++) pthread_mutex_init(&sched.deques[i].lock, NULL);
+    pthread_mutex_init(&sched.lock, NULL);
+    pthread_cond_init(&sched.wake, NULL);
+    ThreadData* thread_data = (ThreadData*)malloc(sizeof(ThreadData) * num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        thread_data[i] = (ThreadData){ .id = i, .scene = scene, .camera = camera, .options = options, .acc = acc, .sched = &sched };
+        sampler_init(&thread_data[i].sampler, i * 123456789ULL, i);
+    }
+
+    TileKey* keys = (TileKey*)malloc(sizeof(TileKey) * total_tiles);
+    int n = 1;
+    while (n < acc->tiles_x || n < acc->tiles_y) n *= 2;
+    for (int t = 0; t < total_tiles; t++) keys[t] = (TileKey){(float)hilbert_index(n, t % acc->tiles_x, t / acc->tiles_x), t};
+    qsort(keys, total_tiles, sizeof(TileKey), compare_tile_keys);
+    for (int t = 0; t < total_tiles; t++) {
+        deque_push(&sched, &sched.deques[(long long)t * num_threads / total_tiles], (TileItem){keys[t].tile, 0, acc->tile_size, 0, 1});
+    }
+    double pilot_start = seconds();
+    run_phase(thread_data, num_threads, options, pass_spp, NULL);
+    double pilot = seconds() - pilot_start;
+
+    for (int t = 0; t < total_tiles; t++) keys[t] = (TileKey){-acc->tile_cost[t], t};
+    qsort(keys, total_tiles, sizeof(TileKey), compare_tile_keys);
+    int dealt = 0;
+    for (int first = 0; first < spp; first += pass_spp) {
+        int begin = first > 1 ? first : 1;
+        int end = first + pass_spp < spp ? first + pass_spp : spp;
+        for (int t = 0; t < total_tiles && begin < end; t++) {
+            deque_push(&sched, &sched.deques[dealt++ % num_threads], (TileItem){keys[t].tile, 0, acc->tile_size, begin, end - begin});
+        }
+    }
+    double tail = dealt > 0 ? run_phase(thread_data, num_threads, options, pass_spp, image) : 0.0;
+    printf("Scheduler: %d tiles of %d px, pilot %.1f ms, %d steals, %d splits, %.1f ms tail\n", total_tiles, acc->tile_size,
+           pilot * 1000.0, atomic_load(&sched.steals), atomic_load(&sched.splits), tail * 1000.0);
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_destroy(&sched.deques[i].lock);
+        free(sched.deques[i].items);
+    }
+    pthread_mutex_destroy(&sched.lock);
+    pthread_cond_destroy(&sched.wake);
+    free(sched.deques);
+    free(thread_data);
+    free(keys);
 }
 
 void render(const Scene* scene, const Camera* camera, const RenderOptions* options) {
@@ -134,53 +801,52 @@ void render(const Scene* scene, const Camera* camera, const RenderOptions* optio
     int height = options->height;
     float* buffer = (float*)calloc(width * height * 3, sizeof(float));
     
-    int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
-    int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
-    atomic_int tile_index = 0;
-    
-    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * options->num_threads);
-    ThreadData* thread_data = (ThreadData*)malloc(sizeof(ThreadData) * options->num_threads);
-    
-    printf("Rendering %dx%d with %d samples, %d threads...\n", width, height, options->samples_per_pixel, options->num_threads);
-    
-    for (int i = 0; i < options->num_threads; i++) {
-        thread_data[i].id = i;
-        thread_data[i].scene = scene;
-        thread_data[i].camera = camera;
-        thread_data[i].options = options;
-        thread_data[i].buffer = buffer;
-        thread_data[i].tile_index = &tile_index;
-        thread_data[i].tiles_x = tiles_x;
-        thread_data[i].tiles_y = tiles_y;
-        pthread_create(&threads[i], NULL, render_thread, &thread_data[i]);
+    int tile_size = TILE_SIZE;
+    while (tile_size > 8 && ((width + tile_size - 1) / tile_size) * ((height + tile_size - 1) / tile_size) < 4 * options->num_threads) {
+        tile_size /= 2;
     }
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    int total_tiles = tiles_x * tiles_y;
+    int spp = options->samples_per_pixel;
+    int pass_spp = options->pass_spp > 0 ? options->pass_spp : spp;
+    int passes = (spp + pass_spp - 1) / pass_spp;
+
+    Accumulator acc = {
+        .sum = (float*)calloc(width * height * 3, sizeof(float)),
+        .lum_sq = (float*)calloc(width * height, sizeof(float)),
+        .samples = (int*)calloc(width * height, sizeof(int)),
+        .tile_locks = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t) * total_tiles),
+        .tile_cost = (float*)calloc(total_tiles, sizeof(float)),
+        .tile_size = tile_size,
+        .tiles_x = tiles_x,
+        .tiles_y = tiles_y,
+        .total = (long long)width * height * spp
+    };
+    pthread_mutex_init(&acc.lock, NULL);
+    pthread_cond_init(&acc.progress, NULL);
+    for (int i = 0; i < total_tiles; i++) pthread_mutex_init(&acc.tile_locks[i], NULL);
     
-    for (int i = 0; i < options->num_threads; i++) {
-        pthread_join(threads[i], NULL);
-    }
+    printf("Rendering %dx%d with %d samples, %d threads%s...\n", width, height, spp, options->num_threads,
+           options->wavefront ? ", wavefront" : "");
+    if (!options->wavefront && passes > 1) printf("Progressive: %d passes of %d spp\n", passes, pass_spp);
     
-    char hdr_filename[256];
-    snprintf(hdr_filename, sizeof(hdr_filename), "%s.hdr", options->output_filename);
-    if (stbi_write_hdr(hdr_filename, width, height, 3, buffer)) {
-        printf("Saved %s\n", hdr_filename);
+    if (options->wavefront) {
+        render_wavefront(scene, camera, options, buffer);
     } else {
-        printf("Error saving HDR\n");
+        render_tiles(scene, camera, options, &acc, buffer);
+        resolve_image(&acc, width, height, buffer);
     }
+    write_image(buffer, width, height, options->output_filename, true);
+    if (!options->wavefront && options->adaptive_threshold > 0.0f) report_samples(&acc, options);
     
-    char png_filename[256];
-    snprintf(png_filename, sizeof(png_filename), "%s.png", options->output_filename);
-    unsigned char* png_data = (unsigned char*)malloc(width * height * 3);
-    for (int i = 0; i < width * height * 3; i++) {
-        float val = buffer[i];
-        val = val / (1.0f + val);
-        val = powf(val, 1.0f / 2.2f);
-        png_data[i] = (unsigned char)(fminf(val, 1.0f) * 255.0f);
-    }
-    stbi_write_png(png_filename, width, height, 3, png_data, width * 3);
-    printf("Saved %s\n", png_filename);
-    
-    free(threads);
-    free(thread_data);
+    for (int i = 0; i < total_tiles; i++) pthread_mutex_destroy(&acc.tile_locks[i]);
+    pthread_mutex_destroy(&acc.lock);
+    pthread_cond_destroy(&acc.progress);
+    free(acc.sum);
+    free(acc.lum_sq);
+    free(acc.samples);
+    free(acc.tile_locks);
+    free(acc.tile_cost);
     free(buffer);
-    free(png_data);
 }
@@ -10,6 +10,14 @@ typedef struct {
     int samples_per_pixel;
     int max_bounces;
     int num_threads;
+    int packet_size;
+    bool wavefront;
+    int pass_spp;
+    int snapshot_passes;
+    float snapshot_seconds;
+    float adaptive_threshold;
+    int min_spp;
+    const char* spp_map_filename;
     const char* output_filename;
 } RenderOptions;
 
@@ -2,8 +2,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 void scene_init(Scene* scene) {
     memset(scene, 0, sizeof(Scene));
+    scene->bvh_options = bvh_default_options();
+    scene->paged_cache_bytes = (size_t)64 << 20;
+    mesh_init(&scene->geometry, true);
 }
 
 void scene_add_material(Scene* scene, Material material) {
@@ -18,35 +22,110 @@ void scene_add_light(Scene* scene, Light light) {
     scene->lights[scene->light_count - 1] = light;
 }
 
+int scene_add_mesh(Scene* scene, const TriangleMesh* geometry) {
+    scene->mesh_count++;
+    scene->meshes = realloc(scene->meshes, sizeof(Mesh) * scene->mesh_count);
+    Mesh* mesh = &scene->meshes[scene->mesh_count - 1];
+    memset(mesh, 0, sizeof(Mesh));
+    mesh->geometry = *geometry;
+    return scene->mesh_count - 1;
+}
+
+int scene_add_instance(Scene* scene, int mesh_id, Mat3 linear, Vec3 translation) {
+    scene->instance_count++;
+    scene->instances = realloc(scene->instances, sizeof(Instance) * scene->instance_count);
+    scene->instances[scene->instance_count - 1] = instance_make(mesh_id, linear, translation);
+    return scene->instance_count - 1;
+}
+
+int scene_add_shape(Scene* scene, Shape shape) {
+    scene->shape_count++;
+    scene->shapes = realloc(scene->shapes, sizeof(Shape) * scene->shape_count);
+    scene->shapes[scene->shape_count - 1] = shape;
+    return scene->shape_count - 1;
+}
+
+// Adds the light together with a matching analytic emitter, so that the
+// geometry rays hit is exactly the surface the light samples.
+int scene_add_area_light(Scene* scene, Light light, int material_id) {
+    scene_add_light(scene, light);
+    if (light.type == LIGHT_ENV) return -1;
+    return scene_add_shape(scene, shape_from_light(&light, material_id));
+}
+
+// Maps OBJ (position, normal) index pairs to mesh vertices so that corners
+// shared between faces are stored once.
+typedef struct {
+    uint64_t* keys;
+    int* values;
+    int capacity;
+    int count;
+} VertexMap;
+
+static void vertex_map_grow(VertexMap* map) {
+    VertexMap old = *map;
+    map->capacity = old.capacity ? old.capacity * 2 : 1024;
+    map->keys = (uint64_t*)malloc(sizeof(uint64_t) * map->capacity);
+    map->values = (int*)malloc(sizeof(int) * map->capacity);
+    for (int i = 0; i < map->capacity; i++) map->keys[i] = UINT64_MAX;
+    for (int i = 0; i < old.capacity; i++) {
+        if (old.keys[i] == UINT64_MAX) continue;
+        uint32_t slot = (uint32_t)((old.keys[i] * 0x9e3779b97f4a7c15ULL) >> 32) & (map->capacity - 1);
+        while (map->keys[slot] != UINT64_MAX) slot = (slot + 1) & (map->capacity - 1);
+        map->keys[slot] = old.keys[i];
+        map->values[slot] = old.values[i];
+    }
+    free(old.keys);
+    free(old.values);
+}
+
+static int* vertex_map_slot(VertexMap* map, uint64_t key) {
+    if (2 * (map->count + 1) > map->capacity) vertex_map_grow(map);
+    uint32_t slot = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (map->capacity - 1);
+    while (map->keys[slot] != UINT64_MAX && map->keys[slot] != key) slot = (slot + 1) & (map->capacity - 1);
+    if (map->keys[slot] == UINT64_MAX) {
+        map->keys[slot] = key;
+        map->values[slot] = -1;
+        map->count++;
+    }
+    return &map->values[slot];
+}
+
+static void push_vec3(Vec3** data, int* count, int* capacity, Vec3 v) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 1024;
+        *data = realloc(*data, sizeof(Vec3) * *capacity);
+    }
+    (*data)[(*count)++] = v;
+}
+
 void scene_load_obj(Scene* scene, const char* filename, int material_id) {
     FILE* f = fopen(filename, "r");
     if (!f) return;
     
+    TriangleMesh* mesh = &scene->geometry;
     Vec3* temp_verts = NULL;
-    int v_count = 0;
+    int v_count = 0, v_capacity = 0;
     Vec3* temp_normals = NULL;
-    int vn_count = 0;
+    int vn_count = 0, vn_capacity = 0;
+    VertexMap map = {0};
     char line[1024];
     
     while (fgets(line, 1024, f)) {
         if (line[0] == 'v' && line[1] == ' ') {
             Vec3 v;
             sscanf(line, "v %f %f %f", &v.x, &v.y, &v.z);
-            v_count++;
-            temp_verts = realloc(temp_verts, sizeof(Vec3) * v_count);
-            temp_verts[v_count - 1] = v;
+            push_vec3(&temp_verts, &v_count, &v_capacity, v);
         } else if (line[0] == 'v' && line[1] == 'n') {
             Vec3 vn;
             sscanf(line, "vn %f %f %f", &vn.x, &vn.y, &vn.z);
-            vn_count++;
-            temp_normals = realloc(temp_normals, sizeof(Vec3) * vn_count);
-            temp_normals[vn_count - 1] = vn;
+            push_vec3(&temp_normals, &vn_count, &vn_capacity, vn);
         } else if (line[0] == 'f') {
             char* p = line + 2;
-            int vertices[3] = {0};
-            int normals[3] = {0};
+            int vertices[4] = {0};
+            int normals[4] = {0};
             
-            for(int i=0; i<3; ++i) {
+            for(int i=0; i<4; ++i) {
                 while(*p == ' ') p++;
                 vertices[i] = atoi(p);
                 while(*p != ' ' && *p != '/' && *p != '\0') p++;
@@ -67,38 +146,308 @@ void scene_load_obj(Scene* scene, const char* filename, int material_id) {
                 }
             }
             
-            scene->tri_count++;
-            scene->triangles = realloc(scene->triangles, sizeof(Triangle) * scene->tri_count);
-            Triangle* t = &scene->triangles[scene->tri_count - 1];
-            t->v0 = temp_verts[vertices[0] - 1];
-            t->v1 = temp_verts[vertices[1] - 1];
-            t->v2 = temp_verts[vertices[2] - 1];
-            
-            if (normals[0] > 0 && vn_count > 0) {
-                t->n0 = temp_normals[normals[0] - 1];
-                t->n1 = temp_normals[normals[1] - 1];
-                t->n2 = temp_normals[normals[2] - 1];
+            // Four-corner faces stay quads; anything past the fourth corner
+            // is ignored.
+            int n = vertices[3] != 0 ? 4 : 3;
+            bool valid = true, smooth = true;
+            for (int i = 0; i < n; i++) {
+                valid &= vertices[i] > 0 && vertices[i] <= v_count;
+                smooth &= normals[i] > 0 && normals[i] <= vn_count;
+            }
+            if (!valid) continue;
+            int corner[4];
+            if (smooth) {
+                for (int i = 0; i < n; i++) {
+                    int* vertex = vertex_map_slot(&map, ((uint64_t)vertices[i] << 32) | (uint32_t)normals[i]);
+                    if (*vertex < 0) *vertex = mesh_add_vertex(mesh, temp_verts[vertices[i] - 1], temp_normals[normals[i] - 1]);
+                    corner[i] = *vertex;
+                }
             } else {
-                Vec3 e1 = vec3_sub(t->v1, t->v0);
-                Vec3 e2 = vec3_sub(t->v2, t->v0);
-                Vec3 n = vec3_normalize(vec3_cross(e1, e2));
-                t->n0 = t->n1 = t->n2 = n;
+                // Faces without normals keep flat shading, so their corners
+                // carry the face normal and cannot be shared.
+                Vec3 v0 = temp_verts[vertices[0] - 1], v1 = temp_verts[vertices[1] - 1], v2 = temp_verts[vertices[2] - 1];
+                Vec3 e = n == 4 ? vec3_sub(temp_verts[vertices[3] - 1], v1) : vec3_sub(v2, v0);
+                Vec3 normal = vec3_normalize(vec3_cross(n == 4 ? vec3_sub(v2, v0) : vec3_sub(v1, v0), e));
+                for (int i = 0; i < n; i++) corner[i] = mesh_add_vertex(mesh, temp_verts[vertices[i] - 1], normal);
             }
-            t->material_id = material_id;
+            if (n == 4) mesh_add_quad(mesh, corner[0], corner[1], corner[2], corner[3], material_id);
+            else mesh_add_triangle(mesh, corner[0], corner[1], corner[2], material_id);
         }
     }
+    free(map.keys);
+    free(map.values);
     free(temp_verts);
     free(temp_normals);
     fclose(f);
 }
 
+static double seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void reorder_scene_meshes(Scene* scene) {
+    int prims = 0, vertices = 0;
+    for (int i = -1; i < scene->mesh_count; i++) {
+        TriangleMesh* mesh = i < 0 ? &scene->geometry : &scene->meshes[i].geometry;
+        mesh_optimize_layout(mesh);
+        prims += mesh_prim_count(mesh);
+        vertices += mesh->vertex_count;
+    }
+    printf("Mesh layout: %d primitives and %d vertices in Morton order\n", prims, vertices);
+}
+
+static void compress_scene_normals(Scene* scene) {
+    float max_error, mean_error, worst = 0.0f;
+    double error_sum = 0.0;
+    long vertices = 0;
+    for (int i = -1; i < scene->mesh_count; i++) {
+        TriangleMesh* mesh = i < 0 ? &scene->geometry : &scene->meshes[i].geometry;
+        if (!mesh->normals) continue;
+        mesh_compress_normals(mesh, &max_error, &mean_error);
+        worst = fmaxf(worst, max_error);
+        error_sum += (double)mean_error * mesh->vertex_count;
+        vertices += mesh->vertex_count;
+    }
+    if (vertices > 0) {
+        printf("Octahedral normals: %ld vertices, %zu KB saved, angular error max %.4f / mean %.4f degrees\n",
+               vertices, (sizeof(Vec3) - sizeof(uint32_t)) * vertices / 1024, worst, error_sum / vertices);
+    }
+}
+
+static void build_scene_bvh(Scene* scene) {
+    double start = seconds();
+    const char* cache = scene->bvh_cache_path;
+    bool cached = cache && bvh_load(&scene->bvh, cache, &scene->geometry, &scene->bvh_options);
+    if (!cached) {
+        bvh_build(&scene->bvh, &scene->geometry, &scene->bvh_options);
+        if (cache && mesh_prim_count(&scene->geometry) > 0 && !bvh_save(&scene->bvh, cache)) printf("Could not write BVH cache %s\n", cache);
+    }
+    printf("Geometry: %d triangles + %d quads, %d vertices, %zu KB indexed (%zu KB as separate triangles)\n",
+           scene->geometry.tri_count, scene->geometry.quad_count, scene->geometry.vertex_count, mesh_bytes(&scene->geometry) / 1024,
+           (sizeof(Vec3) * 6 + sizeof(int)) * (scene->geometry.tri_count + 2 * scene->geometry.quad_count) / 1024);
+    printf("BVH %s in %.1f ms%s%s\n", cached ? "loaded" : "built", (seconds() - start) * 1000.0,
+           cache ? (cached ? " from " : ", cached to ") : "", cache ? cache : "");
+    printf("BVH (%s): %d nodes, %d references, SAH cost %.3f, width %d (%s, %d %swide nodes, %zu KB)\n",
+           bvh_method_name(scene->bvh_options.method),
+           scene->bvh.node_count, scene->bvh.index_count, bvh_sah_cost(&scene->bvh),
+           scene->bvh.width, bvh_isa_name(scene->bvh.isa), scene->bvh.wide_node_count,
+           scene->bvh.compressed ? "compressed " : "", bvh_node_bytes(&scene->bvh) / 1024);
+    printf("Traversal data: %zu KB nodes + %zu KB leaf triangles; shading data: %zu KB normals and materials\n",
+           bvh_node_bytes(&scene->bvh) / 1024, bvh_leaf_bytes(&scene->bvh) / 1024, mesh_shading_bytes(&scene->geometry) / 1024);
+    if (!cached && scene->bvh.unoptimized_sah_cost > 0.0f) {
+        printf("Treelet optimization (%d passes): SAH cost %.3f -> %.3f in %.1f ms\n", scene->bvh_options.treelet_passes,
+               scene->bvh.unoptimized_sah_cost, scene->bvh.build_sah_cost, scene->bvh.optimize_seconds * 1000.0f);
+    }
+}
+
+// The paged file keeps only the top of the tree resident; the in-memory BVH
+// is dropped once the file has been reopened through the geometry cache.
+static void page_scene_bvh(Scene* scene) {
+    const char* path = scene->paged_path;
+    if (mesh_prim_count(&scene->geometry) == 0) return;
+    if (!bvh_paged_write(&scene->bvh, path, BVH_PAGED_CHUNK_BYTES)) {
+        printf("Could not write paged BVH %s\n", path);
+        return;
+    }
+    if (!bvh_paged_open(&scene->paged, path, &scene->geometry, &scene->bvh_options, scene->paged_cache_bytes)) {
+        printf("Could not open paged BVH %s\n", path);
+        return;
+    }
+    bvh_free(&scene->bvh);
+    printf("BVH paged to %s\n", path);
+}
+
 void scene_build(Scene* scene) {
-    bvh_build(&scene->bvh, scene->triangles, scene->tri_count);
+    if (scene->reorder_meshes) reorder_scene_meshes(scene);
+    if (scene->compress_normals) compress_scene_normals(scene);
+    double start = seconds();
+    const char* paged = scene->paged_path;
+    if (paged && bvh_paged_open(&scene->paged, paged, &scene->geometry, &scene->bvh_options, scene->paged_cache_bytes)) {
+        printf("Geometry: %d triangles + %d quads, %d vertices, %zu KB indexed, %zu KB shading data\n", scene->geometry.tri_count,
+               scene->geometry.quad_count, scene->geometry.vertex_count, mesh_bytes(&scene->geometry) / 1024,
+               mesh_shading_bytes(&scene->geometry) / 1024);
+        printf("BVH paged from %s in %.1f ms\n", paged, (seconds() - start) * 1000.0);
+    } else {
+        build_scene_bvh(scene);
+        if (paged) page_scene_bvh(scene);
+    }
+
+    if (scene->shape_count > 0) {
+        shapes_build(&scene->shape_bvh, scene->shapes, scene->shape_count, &scene->bvh_options);
+        printf("Analytic shapes: %d (%zu KB with BVH)\n", scene->shape_count,
+               (sizeof(Shape) * scene->shape_count + sizeof(BVHNode) * scene->shape_bvh.node_count) / 1024);
+    }
+
+    if (scene->instance_count == 0) return;
+    long unique_tris = 0, instanced_tris = 0;
+    size_t meshes_bytes = 0;
+    for (int i = 0; i < scene->mesh_count; i++) {
+        Mesh* mesh = &scene->meshes[i];
+        bvh_build(&mesh->bvh, &mesh->geometry, &scene->bvh_options);
+        unique_tris += mesh_prim_count(&mesh->geometry);
+        meshes_bytes += mesh_bytes(&mesh->geometry) + sizeof(BVHNode) * mesh->bvh.node_count +
+                      (sizeof(int) * 4 + sizeof(TriangleBlock)) * mesh->bvh.tri_block_count;
+    }
+    for (int i = 0; i < scene->instance_count; i++) instanced_tris += mesh_prim_count(&scene->meshes[scene->instances[i].mesh_id].geometry);
+    tlas_build(&scene->tlas, scene->instances, scene->instance_count, scene->meshes, &scene->bvh_options);
+    printf("Instances: %d of %d meshes, %ld unique / %ld instanced primitives, %zu KB meshes + %zu KB instances\n",
+           scene->instance_count, scene->mesh_count, unique_tris, instanced_tris, meshes_bytes / 1024,
+           (sizeof(Instance) * scene->instance_count + sizeof(BVHNode) * scene->tlas.node_count) / 1024);
+}
+
+bool scene_refit(Scene* scene) {
+    bool rebuilt = bvh_refit(&scene->bvh);
+    if (scene->instance_count == 0) return rebuilt;
+    for (int i = 0; i < scene->mesh_count; i++) rebuilt |= bvh_refit(&scene->meshes[i].bvh);
+    bvh_free(&scene->tlas);
+    tlas_build(&scene->tlas, scene->instances, scene->instance_count, scene->meshes, &scene->bvh_options);
+    return rebuilt;
+}
+
+void scene_bvh_report(const Scene* scene, const Ray* rays, int ray_count) {
+    static const struct { const char* name; int width; bool compress; } layouts[] = {
+        {"binary", 2, false}, {"BVH4", 4, false}, {"BVH8", 8, false}, {"BVH4 compressed", 4, true}
+    };
+    printf("BVH layout report (%d primitives, %d rays):\n", mesh_prim_count(&scene->geometry), ray_count);
+    for (int i = 0; i < (int)(sizeof(layouts) / sizeof(layouts[0])); i++) {
+        BVHBuildOptions options = scene->bvh_options;
+        options.width = layouts[i].width;
+        options.compress_nodes = layouts[i].compress;
+        BVH bvh;
+        bvh_build(&bvh, &scene->geometry, &options);
+
+        int hits = 0;
+        double start = seconds();
+        for (int r = 0; r < ray_count; r++) {
+            float t, u, v;
+            int tri_index;
+            hits += bvh_intersect(&bvh, rays[r], 0.001f, MAX_FLOAT, &t, &tri_index, &u, &v);
+        }
+        double elapsed = seconds() - start;
+        printf("  %-16s %10.1f KB nodes  %8.2f Mrays/s  (%s, %d hits)\n", layouts[i].name,
+               bvh_node_bytes(&bvh) / 1024.0, elapsed > 0.0 ? ray_count / elapsed * 1e-6 : 0.0,
+               bvh_isa_name(bvh.isa), hits);
+        bvh_free(&bvh);
+    }
+}
+
+bool scene_intersect(const Scene* scene, Ray r, float t_min, float t_max, Hit* hit) {
+    bool found = scene->paged.top_nodes
+                     ? bvh_paged_intersect(&scene->paged, r, t_min, t_max, &hit->t, &hit->tri_index, &hit->u, &hit->v)
+                     : bvh_intersect(&scene->bvh, r, t_min, t_max, &hit->t, &hit->tri_index, &hit->u, &hit->v);
+    hit->shape_id = -1;
+    if (found) {
+        hit->instance_id = -1;
+        t_max = hit->t;
+    }
+    if (scene->instance_count > 0 && tlas_intersect(&scene->tlas, scene->instances, scene->meshes, r, t_min, t_max, hit)) {
+        found = true;
+        t_max = hit->t;
+    }
+    if (scene->shape_count > 0 && shapes_intersect(&scene->shape_bvh, scene->shapes, r, t_min, t_max, &hit->t, &hit->shape_id, &hit->u, &hit->v)) {
+        found = true;
+        hit->tri_index = hit->instance_id = -1;
+    }
+    if (!found) hit->tri_index = -1;
+    return found;
+}
+
+// Instances and analytic shapes are traced per ray after the scene BVH.
+static void intersect_others(const Scene* scene, Ray r, float t_min, float t_max, Hit* hit) {
+    float closest = hit->tri_index >= 0 ? hit->t : t_max;
+    if (scene->instance_count > 0 && tlas_intersect(&scene->tlas, scene->instances, scene->meshes, r, t_min, closest, hit)) {
+        closest = hit->t;
+    }
+    if (scene->shape_count > 0 && shapes_intersect(&scene->shape_bvh, scene->shapes, r, t_min, closest, &hit->t, &hit->shape_id, &hit->u, &hit->v)) {
+        hit->tri_index = hit->instance_id = -1;
+    }
+}
+
+void scene_intersect_packet(const Scene* scene, const Ray* rays, int count, float t_min, float t_max, Hit* hits) {
+    float t[BVH_MAX_PACKET], u[BVH_MAX_PACKET], v[BVH_MAX_PACKET];
+    int tri_index[BVH_MAX_PACKET];
+    if (scene->paged.top_nodes) bvh_paged_intersect_batch(&scene->paged, rays, count, t_min, t_max, t, tri_index, u, v);
+    else bvh_intersect_packet(&scene->bvh, rays, count, t_min, t_max, t, tri_index, u, v);
+    for (int i = 0; i < count; i++) {
+        hits[i] = (Hit){t[i], u[i], v[i], tri_index[i], -1, -1};
+        intersect_others(scene, rays[i], t_min, t_max, &hits[i]);
+    }
+}
+
+// Streams of any length: packets for the in-memory BVH, one batch for the
+// paged BVH so that each chunk is visited once for all rays of the stream.
+void scene_intersect_stream(const Scene* scene, const Ray* rays, int count, float t_min, float t_max, Hit* hits) {
+    if (!scene->paged.top_nodes) {
+        for (int i = 0; i < count; i += BVH_MAX_PACKET) {
+            scene_intersect_packet(scene, rays + i, count - i < BVH_MAX_PACKET ? count - i : BVH_MAX_PACKET, t_min, t_max, hits + i);
+        }
+        return;
+    }
+    float* t = (float*)malloc(sizeof(float) * 3 * (count > 0 ? count : 1));
+    int* tri_index = (int*)malloc(sizeof(int) * (count > 0 ? count : 1));
+    float *u = t + count, *v = t + 2 * count;
+    bvh_paged_intersect_batch(&scene->paged, rays, count, t_min, t_max, t, tri_index, u, v);
+    for (int i = 0; i < count; i++) {
+        hits[i] = (Hit){t[i], u[i], v[i], tri_index[i], -1, -1};
+        intersect_others(scene, rays[i], t_min, t_max, &hits[i]);
+    }
+    free(t);
+    free(tri_index);
+}
+
+bool scene_occluded(const Scene* scene, Ray r, float t_min, float t_max) {
+    if (scene->paged.top_nodes ? bvh_paged_occluded(&scene->paged, r, t_min, t_max) : bvh_occluded(&scene->bvh, r, t_min, t_max)) return true;
+    if (scene->shape_count > 0 && shapes_occluded(&scene->shape_bvh, scene->shapes, r, t_min, t_max)) return true;
+    return scene->instance_count > 0 && tlas_occluded(&scene->tlas, scene->instances, scene->meshes, r, t_min, t_max);
+}
+
+// Shadow streams with per-ray limits: one batch for the paged BVH, so that
+// each chunk is read once for all shadow rays that enter it.
+void scene_occluded_stream(const Scene* scene, const Ray* rays, int count, float t_min, const float* t_max, bool* occluded) {
+    if (!scene->paged.top_nodes) {
+        for (int i = 0; i < count; i++) occluded[i] = scene_occluded(scene, rays[i], t_min, t_max[i]);
+        return;
+    }
+    bvh_paged_occluded_batch(&scene->paged, rays, count, t_min, t_max, occluded);
+    for (int i = 0; i < count; i++) {
+        if (occluded[i]) continue;
+        occluded[i] = (scene->shape_count > 0 && shapes_occluded(&scene->shape_bvh, scene->shapes, rays[i], t_min, t_max[i])) ||
+                      (scene->instance_count > 0 && tlas_occluded(&scene->tlas, scene->instances, scene->meshes, rays[i], t_min, t_max[i]));
+    }
+}
+
+const TriangleMesh* scene_hit_mesh(const Scene* scene, const Hit* hit) {
+    if (hit->instance_id < 0) return &scene->geometry;
+    return &scene->meshes[scene->instances[hit->instance_id].mesh_id].geometry;
+}
+
+const Material* scene_hit_material(const Scene* scene, const Hit* hit) {
+    if (hit->shape_id >= 0) return &scene->materials[scene->shapes[hit->shape_id].material_id];
+    return &scene->materials[mesh_material(scene_hit_mesh(scene, hit), hit->tri_index)];
+}
+
+Vec3 scene_hit_normal(const Scene* scene, const Hit* hit) {
+    if (hit->shape_id >= 0) return shape_normal(&scene->shapes[hit->shape_id], hit->u, hit->v);
+    Vec3 n = mesh_normal(scene_hit_mesh(scene, hit), hit->tri_index, hit->u, hit->v);
+    if (hit->instance_id < 0) return vec3_normalize(n);
+    return instance_normal_to_world(&scene->instances[hit->instance_id], n);
 }
 
 void scene_free(Scene* scene) {
     bvh_free(&scene->bvh);
-    free(scene->triangles);
+    bvh_paged_close(&scene->paged);
+    bvh_free(&scene->tlas);
+    for (int i = 0; i < scene->mesh_count; i++) {
+        bvh_free(&scene->meshes[i].bvh);
+        mesh_free(&scene->meshes[i].geometry);
+    }
+    free(scene->meshes);
+    free(scene->instances);
+    bvh_free(&scene->shape_bvh);
+    free(scene->shapes);
+    mesh_free(&scene->geometry);
     free(scene->materials);
     free(scene->lights);
 }
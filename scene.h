@@ -3,24 +3,55 @@
 
 #include "types.h"
 #include "bvh.h"
+#include "bvh_paged.h"
+#include "instance.h"
+#include "shape.h"
 #include "material.h"
 #include "light.h"
 
 typedef struct {
     BVH bvh;
-    Triangle* triangles;
-    int tri_count;
+    BVHBuildOptions bvh_options;
+    const char* bvh_cache_path;
+    const char* paged_path;
+    size_t paged_cache_bytes;
+    PagedBVH paged;
+    TriangleMesh geometry;
+    bool reorder_meshes;
+    bool compress_normals;
     Material* materials;
     int material_count;
     Light* lights;
     int light_count;
+    Mesh* meshes;
+    int mesh_count;
+    Instance* instances;
+    int instance_count;
+    BVH tlas;
+    Shape* shapes;
+    int shape_count;
+    BVH shape_bvh;
 } Scene;
 
 void scene_init(Scene* scene);
 void scene_load_obj(Scene* scene, const char* filename, int material_id);
 void scene_add_light(Scene* scene, Light light);
 void scene_add_material(Scene* scene, Material material);
+int scene_add_mesh(Scene* scene, const TriangleMesh* geometry);
+int scene_add_instance(Scene* scene, int mesh_id, Mat3 linear, Vec3 translation);
+int scene_add_shape(Scene* scene, Shape shape);
+int scene_add_area_light(Scene* scene, Light light, int material_id);
 void scene_build(Scene* scene);
+bool scene_refit(Scene* scene);
+void scene_bvh_report(const Scene* scene, const Ray* rays, int ray_count);
+bool scene_intersect(const Scene* scene, Ray r, float t_min, float t_max, Hit* hit);
+void scene_intersect_packet(const Scene* scene, const Ray* rays, int count, float t_min, float t_max, Hit* hits);
+void scene_intersect_stream(const Scene* scene, const Ray* rays, int count, float t_min, float t_max, Hit* hits);
+bool scene_occluded(const Scene* scene, Ray r, float t_min, float t_max);
+void scene_occluded_stream(const Scene* scene, const Ray* rays, int count, float t_min, const float* t_max, bool* occluded);
+const TriangleMesh* scene_hit_mesh(const Scene* scene, const Hit* hit);
+const Material* scene_hit_material(const Scene* scene, const Hit* hit);
+Vec3 scene_hit_normal(const Scene* scene, const Hit* hit);
 void scene_free(Scene* scene);
 
 #endif
@@ -0,0 +1,182 @@
+#include "shape.h"
+#include "bvh_internal.h"
+#include <stdlib.h>
+
+Shape shape_from_light(const Light* light, int material_id) {
+    ShapeType type = light->type == LIGHT_SPHERE ? SHAPE_SPHERE : (light->type == LIGHT_DISK ? SHAPE_DISK : SHAPE_QUAD);
+    return (Shape){type, light->position, light->u, light->v, light->radius, material_id};
+}
+
+AABB shape_bounds(const Shape* shape) {
+    AABB bounds = aabb_empty();
+    if (shape->type == SHAPE_SPHERE) {
+        Vec3 r = {shape->radius, shape->radius, shape->radius};
+        bounds.min = vec3_sub(shape->position, r);
+        bounds.max = vec3_add(shape->position, r);
+    } else if (shape->type == SHAPE_DISK) {
+        Vec3 n = vec3_normalize(vec3_cross(shape->u, shape->v));
+        Vec3 r = {shape->radius * sqrtf(fmaxf(0.0f, 1.0f - n.x * n.x)),
+                  shape->radius * sqrtf(fmaxf(0.0f, 1.0f - n.y * n.y)),
+                  shape->radius * sqrtf(fmaxf(0.0f, 1.0f - n.z * n.z))};
+        bounds.min = vec3_sub(shape->position, r);
+        bounds.max = vec3_add(shape->position, r);
+    } else {
+        bounds = aabb_extend(bounds, shape->position);
+        bounds = aabb_extend(bounds, vec3_add(shape->position, shape->u));
+        bounds = aabb_extend(bounds, vec3_add(shape->position, shape->v));
+        bounds = aabb_extend(bounds, vec3_add(shape->position, vec3_add(shape->u, shape->v)));
+    }
+    return bounds;
+}
+
+// Sphere normals are rebuilt from the (phi, theta) surface parameters, disks
+// and quads are flat.
+Vec3 shape_normal(const Shape* shape, float u, float v) {
+    if (shape->type == SHAPE_SPHERE) {
+        float phi = 2.0f * PI * u, theta = PI * v;
+        return (Vec3){sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta)};
+    }
+    return vec3_normalize(vec3_cross(shape->u, shape->v));
+}
+
+// The discriminant is taken from the distance between the center and the
+// ray's closest approach, which stays accurate for distant small spheres.
+static bool hit_sphere(const Shape* shape, Ray r, float t_min, float t_max, float* t) {
+    Vec3 oc = vec3_sub(r.origin, shape->position);
+    float a = vec3_length_sq(r.direction);
+    float b = vec3_dot(oc, r.direction);
+    Vec3 l = vec3_sub(oc, vec3_scale(r.direction, b / a));
+    float disc = a * (shape->radius * shape->radius - vec3_length_sq(l));
+    if (disc < 0.0f) return false;
+    float c = vec3_length_sq(oc) - shape->radius * shape->radius;
+    float q = -b - copysignf(sqrtf(disc), b);
+    float t0 = q / a, t1 = q != 0.0f ? c / q : t0;
+    if (t0 > t1) { float tmp = t0; t0 = t1; t1 = tmp; }
+    if (t0 > t_min && t0 < t_max) *t = t0;
+    else if (t1 > t_min && t1 < t_max) *t = t1;
+    else return false;
+    return true;
+}
+
+static bool hit_planar(const Shape* shape, Ray r, float t_min, float t_max, float* t) {
+    Vec3 n = vec3_cross(shape->u, shape->v);
+    float denom = vec3_dot(n, r.direction);
+    if (denom == 0.0f) return false;
+    float d = vec3_dot(n, vec3_sub(shape->position, r.origin)) / denom;
+    if (!(d > t_min && d < t_max)) return false;
+    Vec3 local = vec3_sub(ray_at(r, d), shape->position);
+    if (shape->type == SHAPE_DISK) {
+        if (vec3_length_sq(local) > shape->radius * shape->radius) return false;
+    } else {
+        float inv_n2 = 1.0f / vec3_length_sq(n);
+        float alpha = vec3_dot(n, vec3_cross(local, shape->v)) * inv_n2;
+        float beta = vec3_dot(n, vec3_cross(shape->u, local)) * inv_n2;
+        if (alpha < 0.0f || alpha > 1.0f || beta < 0.0f || beta > 1.0f) return false;
+    }
+    *t = d;
+    return true;
+}
+
+static bool hit_shape(const Shape* shape, Ray r, float t_min, float t_max, float* t) {
+    return shape->type == SHAPE_SPHERE ? hit_sphere(shape, r, t_min, t_max, t) : hit_planar(shape, r, t_min, t_max, t);
+}
+
+// Surface parameters in [0, 1]: (phi, theta) for spheres, (radius, angle)
+// for disks and the edge coordinates for quads. Only evaluated for the
+// closest hit.
+static void shape_surface(const Shape* shape, Vec3 p, float* u, float* v) {
+    Vec3 local = vec3_sub(p, shape->position);
+    if (shape->type == SHAPE_SPHERE) {
+        Vec3 d = vec3_scale(local, 1.0f / shape->radius);
+        float phi = atan2f(d.y, d.x);
+        *u = (phi < 0.0f ? phi + 2.0f * PI : phi) / (2.0f * PI);
+        *v = acosf(fminf(fmaxf(d.z, -1.0f), 1.0f)) / PI;
+    } else if (shape->type == SHAPE_DISK) {
+        Vec3 s, t;
+        vec3_coordinate_system(shape_normal(shape, 0.0f, 0.0f), &s, &t);
+        float angle = atan2f(vec3_dot(local, t), vec3_dot(local, s));
+        *u = vec3_length(local) / shape->radius;
+        *v = (angle < 0.0f ? angle + 2.0f * PI : angle) / (2.0f * PI);
+    } else {
+        Vec3 n = vec3_cross(shape->u, shape->v);
+        float inv_n2 = 1.0f / vec3_length_sq(n);
+        *u = vec3_dot(n, vec3_cross(local, shape->v)) * inv_n2;
+        *v = vec3_dot(n, vec3_cross(shape->u, local)) * inv_n2;
+    }
+}
+
+void shapes_build(BVH* bvh, const Shape* shapes, int count, const BVHBuildOptions* options) {
+    AABB* boxes = (AABB*)malloc(sizeof(AABB) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; i++) boxes[i] = shape_bounds(&shapes[i]);
+    bvh_build_boxes(bvh, boxes, count, options);
+    free(boxes);
+}
+
+bool shapes_intersect(const BVH* bvh, const Shape* shapes, Ray r, float t_min, float t_max, float* t, int* shape_id, float* u, float* v) {
+    if (!bvh->nodes) return false;
+    int closest = -1;
+    float closest_t = t_max;
+    Vec3 inv_dir = {safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+    int dir_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+    int stack[64];
+    int stack_ptr = 0;
+    int current = 0;
+
+    while (true) {
+        const BVHNode* node = &bvh->nodes[current];
+        if (intersect_aabb(&node->bounds, r.origin, inv_dir, dir_neg, t_min, closest_t)) {
+            if (node->prim_count > 0) {
+                for (int i = 0; i < node->prim_count; i++) {
+                    int id = bvh->prim_indices[node->prim_offset + i];
+                    if (hit_shape(&shapes[id], r, t_min, closest_t, &closest_t)) closest = id;
+                }
+                if (stack_ptr == 0) break;
+                current = stack[--stack_ptr];
+            } else if (dir_neg[node->axis]) {
+                stack[stack_ptr++] = current + 1;
+                current = node->second_child_offset;
+            } else {
+                stack[stack_ptr++] = node->second_child_offset;
+                current = current + 1;
+            }
+        } else {
+            if (stack_ptr == 0) break;
+            current = stack[--stack_ptr];
+        }
+    }
+    if (closest < 0) return false;
+    *t = closest_t;
+    *shape_id = closest;
+    shape_surface(&shapes[closest], ray_at(r, closest_t), u, v);
+    return true;
+}
+
+bool shapes_occluded(const BVH* bvh, const Shape* shapes, Ray r, float t_min, float t_max) {
+    if (!bvh->nodes) return false;
+    Vec3 inv_dir = {safe_rcp(r.direction.x), safe_rcp(r.direction.y), safe_rcp(r.direction.z)};
+    int dir_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+    int stack[64];
+    int stack_ptr = 0;
+    int current = 0;
+
+    while (true) {
+        const BVHNode* node = &bvh->nodes[current];
+        if (intersect_aabb(&node->bounds, r.origin, inv_dir, dir_neg, t_min, t_max)) {
+            if (node->prim_count > 0) {
+                for (int i = 0; i < node->prim_count; i++) {
+                    float t;
+                    if (hit_shape(&shapes[bvh->prim_indices[node->prim_offset + i]], r, t_min, t_max, &t)) return true;
+                }
+                if (stack_ptr == 0) break;
+                current = stack[--stack_ptr];
+            } else {
+                stack[stack_ptr++] = node->second_child_offset;
+                current = current + 1;
+            }
+        } else {
+            if (stack_ptr == 0) break;
+            current = stack[--stack_ptr];
+        }
+    }
+    return false;
+}
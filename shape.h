@@ -0,0 +1,28 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include "bvh.h"
+#include "light.h"
+
+typedef enum { SHAPE_SPHERE, SHAPE_DISK, SHAPE_QUAD } ShapeType;
+
+// Analytic primitive, laid out like Light: position is the sphere or disk
+// center, or the quad corner. u and v span the quad, and the plane of the
+// disk; the facing direction of disks and quads is cross(u, v).
+typedef struct {
+    ShapeType type;
+    Vec3 position;
+    Vec3 u, v;
+    float radius;
+    int material_id;
+} Shape;
+
+Shape shape_from_light(const Light* light, int material_id);
+AABB shape_bounds(const Shape* shape);
+Vec3 shape_normal(const Shape* shape, float u, float v);
+
+void shapes_build(BVH* bvh, const Shape* shapes, int count, const BVHBuildOptions* options);
+bool shapes_intersect(const BVH* bvh, const Shape* shapes, Ray r, float t_min, float t_max, float* t, int* shape_id, float* u, float* v);
+bool shapes_occluded(const BVH* bvh, const Shape* shapes, Ray r, float t_min, float t_max);
+
+#endif
@@ -0,0 +1,69 @@
+// Clustered LBVH input: 63 triangles placed on the 21-bit Morton grid so that
+// each one differs from the cluster at the origin in exactly one code bit,
+// plus 200k coincident triangles that share a single Morton code. Splitting
+// once per differing bit would chain 63 levels before the median splits of
+// the cluster start, but traversal stacks hold 64 entries, so the tree must
+// stay shallower than that and still find every hit.
+#include "bvh.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define GRID ((1 << 21) - 1)
+#define CLUSTER 200000
+
+static int max_depth(const BVH* bvh, int node, int depth) {
+    const BVHNode* n = &bvh->nodes[node];
+    if (n->prim_count > 0) return depth;
+    int a = max_depth(bvh, node + 1, depth + 1);
+    int b = max_depth(bvh, n->second_child_offset, depth + 1);
+    return a > b ? a : b;
+}
+
+static Vec3 chain_centroid(int k) {
+    float offset = (float)(1 << (20 - k / 3));
+    return (Vec3){k % 3 == 0 ? offset : 0.0f, k % 3 == 1 ? offset : 0.0f, k % 3 == 2 ? offset : 0.0f};
+}
+
+// Triangle whose centroid is exactly c, so it lands on the grid point.
+static void add_triangle(TriangleMesh* mesh, Vec3 c) {
+    Vec3 n = {0, 0, 1};
+    int a = mesh_add_vertex(mesh, vec3_add(c, (Vec3){-1, -1, 0}), n);
+    int b = mesh_add_vertex(mesh, vec3_add(c, (Vec3){2, -1, 0}), n);
+    int d = mesh_add_vertex(mesh, vec3_add(c, (Vec3){-1, 2, 0}), n);
+    mesh_add_triangle(mesh, a, b, d, 0);
+}
+
+int main(void) {
+    TriangleMesh mesh;
+    mesh_init(&mesh, true);
+    for (int k = 0; k < 63; k++) add_triangle(&mesh, chain_centroid(k));
+    add_triangle(&mesh, (Vec3){GRID, GRID, GRID});
+    for (int i = 0; i < CLUSTER; i++) add_triangle(&mesh, (Vec3){0, 0, 0});
+
+    BVHBuildOptions options = bvh_default_options();
+    options.method = BVH_BUILD_LBVH;
+    options.morton_bits = 63;
+    options.width = 2;
+    BVH bvh;
+    bvh_build(&bvh, &mesh, &options);
+    options.method = BVH_BUILD_SAH;
+    BVH reference;
+    bvh_build(&reference, &mesh, &options);
+    int depth = max_depth(&bvh, 0, 0);
+
+    int failures = 0;
+    for (int k = 0; k <= 63; k++) {
+        Vec3 c = k < 63 ? chain_centroid(k) : (Vec3){0, 0, 0};
+        Ray r = {vec3_add(c, (Vec3){0.25f, 0.25f, 4.0f * GRID}), {0, 0, -1}};
+        float t, u, v, ref_t;
+        int tri;
+        bool hit = bvh_intersect(&bvh, r, 0.0f, MAX_FLOAT, &t, &tri, &u, &v);
+        bool ref_hit = bvh_intersect(&reference, r, 0.0f, MAX_FLOAT, &ref_t, &tri, &u, &v);
+        if (!hit || !ref_hit || t != ref_t || !bvh_occluded(&bvh, r, 0.0f, MAX_FLOAT)) failures++;
+    }
+    printf("lbvh clustered: %d nodes, depth %d, %d failed rays\n", bvh.node_count, depth, failures);
+    bvh_free(&reference);
+    bvh_free(&bvh);
+    mesh_free(&mesh);
+    return depth < 64 && failures == 0 ? 0 : 1;
+}